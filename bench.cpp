@@ -0,0 +1,1156 @@
+#include "wpcombine.h"
+#include "wplog.h"
+#include "wpmeter.h"
+#include "wprandom.h"
+#include "wpshared.h"
+#include "wpstats.h"
+#include "wptiles.h"
+#include "wpower.h"
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <malloc.h>
+#include <math.h>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// hardware cache misses of this thread, stop() returns -1 where perf events
+// are not available
+class PerfCounter {
+public:
+  PerfCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~PerfCounter() {
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+  }
+  bool isOpen() const { return m_fd >= 0; }
+  void start() {
+    if (m_fd >= 0) {
+      ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  long long stop() {
+    long long count = -1;
+    if (m_fd >= 0) {
+      ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+      }
+    }
+    return count;
+  }
+
+private:
+  int m_fd;
+};
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+const char *typeName(TREETYPE type) {
+  switch (type) {
+  case BST:
+    return "BST";
+  case AVL:
+    return "AVL";
+  case SPLAY:
+    return "SPLAY";
+  case REDBLACK:
+    return "REDBLACK";
+  case SKIPLIST:
+    return "SKIPLIST";
+  }
+  return "?";
+}
+
+// mixed stream: half inserts, half removes of ids drawn from the full range
+double benchMixed(TREETYPE type, int prefill, int ops) {
+  Random idGen(MINID, MAXID);
+  Random coinGen(0, 1);
+  Random latGen(MINLAT, MAXLAT, UNIFORMREAL);
+  Random longGen(MINLONG, MAXLONG, UNIFORMREAL);
+  WirelessPower wp(type);
+  for (int i = 0; i < prefill; i++) {
+    Customer customer(idGen.getRandNum(), latGen.getRealRandNum(),
+                      longGen.getRealRandNum());
+    wp.insert(customer);
+  }
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < ops; i++) {
+    int id = idGen.getRandNum();
+    if (coinGen.getRandNum() == 0) {
+      Customer customer(id, latGen.getRealRandNum(), longGen.getRealRandNum());
+      wp.insert(customer);
+    } else {
+      wp.remove(id);
+    }
+  }
+  return elapsedMs(start);
+}
+
+// worst single insert while a BST holding every id converts to AVL, all at
+// once or incrementally with the given budget. A sorted BST is one chain.
+void benchConversion(int budget, bool sorted) {
+  vector<int> ids;
+  for (int id = MINID; id <= MAXID; id++) {
+    ids.push_back(id);
+  }
+  if (!sorted) {
+    shuffle(ids.begin(), ids.end(), std::mt19937(10));
+  }
+  WirelessPower wp(BST);
+  for (int id : ids) {
+    Customer customer(id, 0, 0);
+    wp.insertHinted(customer); // O(1) down the chain
+  }
+  Random idGen(MINID, MAXID);
+  Clock::time_point start = Clock::now();
+  wp.setType(AVL, budget);
+  double setTypeMs = elapsedMs(start);
+  vector<double> latencies;
+  start = Clock::now();
+  while (wp.isConverting()) {
+    Clock::time_point opStart = Clock::now();
+    Customer customer(idGen.getRandNum(), 0, 0);
+    wp.insert(customer);
+    latencies.push_back(elapsedMs(opStart) * 1000.0);
+  }
+  double totalMs = elapsedMs(start);
+  sort(latencies.begin(), latencies.end());
+  cout << "  " << (sorted ? "sorted" : "shuffled") << ", budget " << budget
+       << ": setType " << setTypeMs << " ms, "
+       << latencies.size() << " ops to finish in " << totalMs << " ms";
+  if (!latencies.empty()) {
+    cout << ", p99 op " << latencies[latencies.size() * 99 / 100]
+         << " us, worst op " << latencies.back() << " us";
+  }
+  cout << endl;
+}
+
+// insert/remove stream with no log or a log with the given commit budget,
+// commitMicros < 0 means no log
+void benchLogged(int ops, int commitMicros) {
+  string path = "bench.wal";
+  std::remove(path.c_str());
+  std::remove((path + ".snap").c_str());
+  Random idGen(MINID, MAXID);
+  WirelessPower wp(AVL);
+  double ms = 0;
+  {
+    MutationLog log(path, max(commitMicros, 0));
+    if (commitMicros >= 0) {
+      wp.attachLog(&log);
+    }
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < ops; i++) {
+      int id = idGen.getRandNum();
+      if (i % 2 == 0) {
+        Customer customer(id, 0, 0);
+        wp.insert(customer);
+      } else {
+        wp.remove(id);
+      }
+    }
+    log.commit();
+    ms = elapsedMs(start);
+  }
+  cout << "    mutations: " << ms << " ms" << endl;
+  if (commitMicros >= 0) {
+    WirelessPower copy(AVL);
+    MutationLog log(path);
+    Clock::time_point start = Clock::now();
+    int records = log.replay(copy);
+    cout << "    replay of " << records << " records: " << elapsedMs(start)
+         << " ms" << endl;
+  }
+  std::remove(path.c_str());
+}
+
+// diff of two registries holding every id that differ in changes customers,
+// with subtree hashes or with the full in-order merge
+void benchDiff(int changes, bool hashing) {
+  WirelessPower primary(AVL);
+  WirelessPower replica(AVL);
+  primary.setHashing(hashing);
+  replica.setHashing(hashing);
+  for (int id = MINID; id <= MAXID; id++) {
+    Customer customer(id, 0, 0);
+    primary.insert(customer);
+    replica.insert(customer);
+  }
+  Random idGen(MINID, MAXID);
+  for (int i = 0; i < changes; i++) {
+    int id = idGen.getRandNum();
+    replica.remove(id);
+    replica.insert(Customer(id, 1, 1));
+  }
+  vector<CustomerDelta> delta;
+  Clock::time_point start = Clock::now();
+  primary.diff(replica, delta);
+  double ms = elapsedMs(start);
+  cout << "  " << (hashing ? "hashed" : "full walk") << ", " << changes
+       << " changes: " << delta.size() << " deltas in " << ms * 1000.0
+       << " us" << endl;
+}
+
+void benchVerify() {
+  WirelessPower wp(AVL);
+  vector<int> ids;
+  for (int id = MINID; id <= MAXID; id++) {
+    ids.push_back(id);
+  }
+  shuffle(ids.begin(), ids.end(), std::mt19937(10));
+  for (int id : ids) {
+    Customer customer(id, 0, 0);
+    wp.insert(customer);
+  }
+  cout << "Verifying a " << ids.size() << " node AVL tree:" << endl;
+  Clock::time_point start;
+  bool pass = false;
+  int threadCounts[] = {1, 2, 4, 8};
+  for (int threads : threadCounts) {
+    start = Clock::now();
+    pass = wp.verify(threads);
+    cout << "  verify(" << threads << "): " << elapsedMs(start) << " ms ("
+         << pass << ")" << endl;
+  }
+  start = Clock::now();
+  pass = wp.verifySample(1000);
+  cout << "  verifySample(1000): " << elapsedMs(start) << " ms (" << pass
+       << ")" << endl;
+}
+
+// distinct 4KB pages touched per search, a cache behaviour measure that
+// does not need hardware counters
+double pagesPerSearch(const WirelessPower &wp, const vector<int> &ids) {
+  long long pages = 0;
+  vector<const Customer *> path;
+  for (int id : ids) {
+    vector<uintptr_t> seen;
+    path.clear();
+    wp.searchPath(id, path);
+    for (const Customer *customer : path) {
+      uintptr_t page = (uintptr_t)customer >> 12;
+      if (find(seen.begin(), seen.end(), page) == seen.end()) {
+        seen.push_back(page);
+      }
+    }
+    pages += seen.size();
+  }
+  return (double)pages / ids.size();
+}
+
+void benchLookups(WirelessPower &wp, const vector<int> &ids,
+                  const char *label) {
+  PerfCounter misses;
+  misses.start();
+  Clock::time_point start = Clock::now();
+  int hits = 0;
+  for (int id : ids) {
+    hits += wp.touch(id) ? 1 : 0;
+  }
+  double ms = elapsedMs(start);
+  long long missCount = misses.stop();
+  cout << "  " << label << ": " << ms * 1e6 / ids.size() << " ns/lookup, "
+       << pagesPerSearch(wp, ids) << " pages/search, ";
+  if (missCount >= 0) {
+    cout << (double)missCount / ids.size() << " cache misses/lookup, ";
+  }
+  cout << hits << " hits" << endl;
+}
+
+void benchCompact() {
+  // months of churn, interleaved with other allocations
+  WirelessPower wp(AVL);
+  vector<int> ids;
+  for (int id = MINID; id <= MAXID; id++) {
+    ids.push_back(id);
+  }
+  std::mt19937 generator(10);
+  shuffle(ids.begin(), ids.end(), generator);
+  vector<string *> noise;
+  for (int round = 0; round < 4; round++) {
+    for (int id : ids) {
+      wp.insert(Customer(id, 0, 0));
+      noise.push_back(new string(generator() % 200, 'x'));
+    }
+    shuffle(ids.begin(), ids.end(), generator);
+    for (int i = 0; i < (int)ids.size() / 2; i++) {
+      wp.remove(ids[i]);
+    }
+  }
+  for (string *text : noise) {
+    delete text;
+  }
+  std::uniform_int_distribution<int> idDist(MINID, MAXID);
+  vector<int> lookups(1000000);
+  for (int &id : lookups) {
+    id = idDist(generator);
+  }
+  cout << "Relayout of a churned AVL tree:" << endl;
+  if (!PerfCounter().isOpen()) {
+    cout << "  (no perf events here, 4KB pages per search stand in for cache "
+            "misses)"
+         << endl;
+  }
+  benchLookups(wp, lookups, "scattered");
+  WirelessPower incremental(AVL);
+  incremental = wp;
+  Clock::time_point start = Clock::now();
+  wp.compact();
+  cout << "  compact(): " << elapsedMs(start) << " ms" << endl;
+  benchLookups(wp, lookups, "vEB order");
+  int steps = 0;
+  start = Clock::now();
+  while (incremental.compact(1024)) {
+    steps++;
+  }
+  cout << "  compact(1024): " << steps + 1 << " steps, "
+       << elapsedMs(start) << " ms" << endl;
+  benchLookups(incremental, lookups, "vEB chunks");
+}
+
+// touches every id of trace in a SPLAY tree that starts out balanced over
+// every id, reports the depth each touched customer was found at, the
+// rotations spent per touch and the time per touch of a second run
+void benchSplayPolicy(const vector<int> &trace, SPLAYPOLICY policy,
+                      double parameter, const string &name) {
+  long long depths = 0;
+  int rotations = 0;
+  double ms = 0;
+  for (int run = 0; run < 2; run++) {
+    WirelessPower wp(AVL);
+    for (int id = MINID; id <= MAXID; id++) {
+      wp.insert(Customer(id, 0, 0));
+    }
+    wp.setType(SPLAY);
+    wp.setSplayPolicy(policy, parameter);
+    int before = wp.rotations();
+    vector<const Customer *> path;
+    Clock::time_point start = Clock::now();
+    for (int id : trace) {
+      if (run == 0) {
+        path.clear();
+        wp.searchPath(id, path);
+        depths += path.size() - 1;
+      }
+      wp.touch(id);
+    }
+    ms = elapsedMs(start);
+    rotations = wp.rotations() - before;
+  }
+  cout << "  " << name << ": average depth "
+       << (double)depths / trace.size() << ", "
+       << (double)rotations / trace.size() << " rotations and "
+       << ms * 1e6 / trace.size() << " ns per touch" << endl;
+}
+
+// fills an unbounded cache from trace to just past the eviction point and
+// times the single eviction pass setting the capacity runs there
+double evictNsEach(const vector<int> &trace, int capacity) {
+  WirelessPower cache(SPLAY);
+  cache.setCounting(true);
+  int limit = capacity + max(1, capacity / 8);
+  for (int i = 0;
+       i < (int)trace.size() && cache.countRange(MINID, MAXID) <= limit; i++) {
+    if (!cache.touch(trace[i])) {
+      cache.insert(Customer(trace[i], 0, 0));
+    }
+  }
+  int before = cache.countRange(MINID, MAXID);
+  Clock::time_point start = Clock::now();
+  cache.setCapacity(capacity); // evicts right away
+  double ms = elapsedMs(start);
+  return ms * 1e6 / max(1, before - cache.countRange(MINID, MAXID));
+}
+
+// threads writers each doing ops mixed inserts and removes, through one
+// mutex or through the combiner, window > 1 keeps that many ops in flight
+void benchContention(int threads, int ops, bool combining, int window) {
+  WirelessPower wp(AVL);
+  std::mutex lock;
+  CombiningWirelessPower combiner(wp);
+  vector<std::thread> writers;
+  Clock::time_point start = Clock::now();
+  for (int t = 0; t < threads; t++) {
+    writers.push_back(std::thread([&, t]() {
+      std::mt19937 generator(t);
+      vector<std::future<bool>> inFlight;
+      for (int i = 0; i < ops; i++) {
+        int id = MINID + generator() % (MAXID - MINID + 1);
+        if (!combining) {
+          std::lock_guard<std::mutex> guard(lock);
+          if (i % 2 == 0) {
+            wp.insert(Customer(id, 0, 0));
+          } else {
+            wp.remove(id);
+          }
+          continue;
+        }
+        inFlight.push_back((i % 2 == 0)
+                               ? combiner.insertAsync(Customer(id, 0, 0))
+                               : combiner.removeAsync(id));
+        if ((int)inFlight.size() == window) {
+          for (std::future<bool> &result : inFlight) {
+            result.get();
+          }
+          inFlight.clear();
+        }
+      }
+      for (std::future<bool> &result : inFlight) {
+        result.get();
+      }
+    }));
+  }
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+  double ms = elapsedMs(start);
+  cout << "  " << threads << " threads, "
+       << (combining ? "combining, window " + to_string(window) : "mutex")
+       << ": " << (threads * ops / ms) * 1000.0 << " ops/s";
+  if (combining) {
+    cout << " in " << combiner.batches() << " batches";
+  }
+  cout << endl;
+}
+
+// count-in-box at a zoom level from tile counts against a full scan
+void benchTiles(int levels) {
+  Random latGen(MINLAT, MAXLAT, UNIFORMREAL);
+  Random longGen(MINLONG, MAXLONG, UNIFORMREAL);
+  WirelessPower plain(AVL);
+  WirelessPower tiled(AVL);
+  tiled.setTiling(levels);
+  vector<Customer> customers;
+  for (int id = MINID; id <= MAXID; id++) {
+    customers.push_back(
+        Customer(id, latGen.getRealRandNum(), longGen.getRealRandNum()));
+  }
+  Clock::time_point start = Clock::now();
+  for (const Customer &customer : customers) {
+    plain.insert(customer);
+  }
+  double plainMs = elapsedMs(start);
+  start = Clock::now();
+  for (const Customer &customer : customers) {
+    tiled.insert(customer);
+  }
+  double tiledMs = elapsedMs(start);
+  cout << "Tile counts, " << customers.size() << " customers, " << levels
+       << " levels:" << endl;
+  cout << "  inserts: " << plainMs << " ms untiled, " << tiledMs
+       << " ms tiled" << endl;
+
+  const TileCounts *tiles = tiled.getTiles();
+  int queries = 1000;
+  long long total = 0;
+  start = Clock::now();
+  for (int i = 0; i < queries; i++) {
+    double lat = latGen.getRealRandNum();
+    double longitude = longGen.getRealRandNum();
+    total += tiles->countInBox(levels - 1, lat, longitude, lat + 20,
+                               longitude + 40);
+  }
+  double tileUs = elapsedMs(start) * 1000.0 / queries;
+  start = Clock::now();
+  for (int i = 0; i < 10; i++) { // the scan a dashboard refresh does today
+    double lat = latGen.getRealRandNum();
+    double longitude = longGen.getRealRandNum();
+    for (const Customer &customer : customers) {
+      total += (customer.getLatitude() >= lat &&
+                customer.getLatitude() <= lat + 20 &&
+                customer.getLongitude() >= longitude &&
+                customer.getLongitude() <= longitude + 40);
+    }
+  }
+  double scanUs = elapsedMs(start) * 1000.0 / 10;
+  cout << "  20x40 degree box: " << tileUs << " us from tiles, " << scanUs
+       << " us by scan, " << total << " hits" << endl;
+}
+
+void benchRemoveRange(TREETYPE type, int size, int removed) {
+  // dense ids so [low, low + removed) holds exactly removed customers
+  vector<Customer> customers;
+  for (int id = MINID; id < MINID + size; id++) {
+    customers.push_back(Customer(id, 0, 0));
+  }
+  WirelessPower one(type);
+  WirelessPower range(type);
+  WirelessPower batch(type);
+  for (const Customer &customer : customers) {
+    one.insert(customer);
+    range.insert(customer);
+    batch.insert(customer);
+  }
+  int low = MINID + size / 3;
+  int high = low + removed - 1;
+  vector<int> ids;
+  for (int id = low; id <= high; id++) {
+    ids.push_back(id);
+  }
+  Clock::time_point start = Clock::now();
+  for (int id : ids) {
+    one.remove(id);
+  }
+  double oneMs = elapsedMs(start);
+  start = Clock::now();
+  range.removeRange(low, high);
+  double rangeMs = elapsedMs(start);
+  start = Clock::now();
+  batch.removeBatch(ids);
+  double batchMs = elapsedMs(start);
+  cout << "  " << typeName(type) << ": " << oneMs << " ms one by one, "
+       << rangeMs << " ms removeRange, " << batchMs << " ms removeBatch"
+       << endl;
+}
+
+// ranks 0..n-1 drawn with probability proportional to 1 / (rank + 1)^skew,
+// each rank mapped to a shuffled id so hot ids are spread over the tree
+vector<int> zipfTrace(int n, double skew, int length) {
+  vector<double> cdf(n);
+  double total = 0;
+  for (int rank = 0; rank < n; rank++) {
+    total += 1.0 / pow(rank + 1, skew);
+    cdf[rank] = total;
+  }
+  vector<int> ids(n);
+  for (int i = 0; i < n; i++) {
+    ids[i] = MINID + i;
+  }
+  std::mt19937 generator(10);
+  shuffle(ids.begin(), ids.end(), generator);
+  std::uniform_real_distribution<double> uniform(0, total);
+  vector<int> trace(length);
+  for (int i = 0; i < length; i++) {
+    int rank = lower_bound(cdf.begin(), cdf.end(), uniform(generator)) -
+               cdf.begin();
+    trace[i] = ids[min(rank, n - 1)];
+  }
+  return trace;
+}
+
+// a hit splays the customer to the root, a miss inserts it
+double runSplayCache(const vector<int> &trace, int capacity, int &hits) {
+  WirelessPower cache(SPLAY);
+  cache.setCapacity(capacity);
+  hits = 0;
+  Clock::time_point start = Clock::now();
+  for (int id : trace) {
+    if (cache.touch(id)) {
+      hits++;
+    } else {
+      cache.insert(Customer(id, 0, 0));
+    }
+  }
+  return elapsedMs(start);
+}
+
+double runLRUCache(const vector<int> &trace, int capacity, int &hits) {
+  list<int> recency; // most recent first
+  unordered_map<int, list<int>::iterator> entries;
+  hits = 0;
+  Clock::time_point start = Clock::now();
+  for (int id : trace) {
+    unordered_map<int, list<int>::iterator>::iterator entry = entries.find(id);
+    if (entry != entries.end()) {
+      hits++;
+      recency.splice(recency.begin(), recency, entry->second);
+      continue;
+    }
+    recency.push_front(id);
+    entries[id] = recency.begin();
+    if ((int)entries.size() > capacity) {
+      entries.erase(recency.back());
+      recency.pop_back();
+    }
+  }
+  return elapsedMs(start);
+}
+
+void benchSplayCache(int capacity, const vector<int> &trace) {
+  int splayHits = 0;
+  int lruHits = 0;
+  double splayMs = runSplayCache(trace, capacity, splayHits);
+  double lruMs = runLRUCache(trace, capacity, lruHits);
+  double length = trace.size();
+  cout << "  capacity " << capacity << ": splay " << 100.0 * splayHits / length
+       << "% hits " << splayMs << " ms, LRU " << 100.0 * lruHits / length
+       << "% hits " << lruMs << " ms, eviction "
+       << evictNsEach(trace, capacity) << " ns per customer" << endl;
+}
+
+void benchProfiling(TREETYPE type, int ops) {
+  double ms[2];
+  for (int profiling = 0; profiling < 2; profiling++) {
+    WirelessPower wp(type);
+    wp.setProfiling(profiling == 1);
+    Random idGen(MINID, MAXID);
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < ops; i++) {
+      wp.insert(Customer(idGen.getRandNum(), 0, 0));
+      wp.remove(idGen.getRandNum());
+    }
+    ms[profiling] = elapsedMs(start);
+    if (profiling == 1) {
+      const LatencyStats *stats = wp.getStats();
+      cout << "  " << typeName(type) << ": " << ms[0] << " ms unprofiled, "
+           << ms[1] << " ms profiled, insert p50/p99/p99.9 "
+           << stats->percentile(OP_INSERT, type, 50) << "/"
+           << stats->percentile(OP_INSERT, type, 99) << "/"
+           << stats->percentile(OP_INSERT, type, 99.9) << " ns, "
+           << stats->slowOps().size() << " slow samples" << endl;
+    }
+  }
+}
+
+// the id range only holds 90000 customers, so onboarding is repeated
+void benchSequentialInsert(TREETYPE type, int rounds) {
+  double plainMs = 0;
+  double hintedMs = 0;
+  for (int round = 0; round < rounds; round++) {
+    WirelessPower plain(type);
+    WirelessPower hinted(type);
+    Clock::time_point start = Clock::now();
+    for (int id = MINID; id <= MAXID; id++) {
+      plain.insert(Customer(id, 0, 0));
+    }
+    plainMs += elapsedMs(start);
+    start = Clock::now();
+    for (int id = MINID; id <= MAXID; id++) {
+      hinted.insertHinted(Customer(id, 0, 0));
+    }
+    hintedMs += elapsedMs(start);
+  }
+  cout << "  " << typeName(type) << ": " << plainMs << " ms insert, "
+       << hintedMs << " ms insertHinted" << endl;
+}
+
+// threads each doing ops lookups, inserts and removes (8:1:1) on a half full
+// registry, a lock-free SKIPLIST against an AVL tree behind one mutex
+void benchSkipList(TREETYPE type, int threads, int ops) {
+  WirelessPower wp(type);
+  for (int id = MINID; id <= MAXID; id += 2) {
+    wp.insert(Customer(id, 0, 0));
+  }
+  std::mutex lock;
+  bool locked = type != SKIPLIST;
+  vector<std::thread> workers;
+  Clock::time_point start = Clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&, t]() {
+      std::mt19937 generator(t);
+      for (int i = 0; i < ops; i++) {
+        int id = MINID + generator() % (MAXID - MINID + 1);
+        std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+        if (locked) {
+          guard.lock();
+        }
+        if (i % 10 == 8) {
+          wp.insert(Customer(id, 0, 0));
+        } else if (i % 10 == 9) {
+          wp.remove(id);
+        } else {
+          wp.touch(id);
+        }
+      }
+    }));
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  double ms = elapsedMs(start);
+  cout << "  " << typeName(type) << (locked ? " with a mutex" : "") << ", "
+       << threads << " threads: " << (threads * ops / ms) * 1000.0
+       << " ops/s" << endl;
+}
+
+// one day of readings every 5 minutes for every customer, an hourly fleet
+// rollup from the compressed store against readings kept raw in a side map
+// keyed by id
+void benchMetering() {
+  WirelessPower wp(AVL);
+  wp.setMetering(true);
+  unordered_map<int, vector<pair<long long, double>>> side;
+  std::mt19937 generator(10);
+  std::uniform_int_distribution<int> step(-20, 20);
+  long long day = 24 * 3600;
+  for (int id = MINID; id <= MAXID; id++) {
+    wp.insert(Customer(id, 0, 0));
+    double watts = 500;
+    for (long long time = 0; time < day; time += 300) {
+      watts = max(0.0, watts + step(generator) / 10.0); // 0.1 W resolution
+      wp.addReading(id, time, watts);
+      side[id].push_back(make_pair(time, watts));
+    }
+  }
+  long long samples = (long long)(MAXID - MINID + 1) * (day / 300);
+  size_t bytes = 0;
+  for (int id = MINID; id <= MAXID; id++) {
+    bytes += wp.meterBytes(id);
+  }
+  cout << "  " << samples << " readings, " << (double)bytes / samples
+       << " bytes each compressed against 16 raw" << endl;
+
+  Clock::time_point start = Clock::now();
+  vector<MeterAggregate> sideHours(24);
+  for (int id = MINID; id <= MAXID; id++) {
+    for (const pair<long long, double> &reading : side[id]) {
+      sideHours[reading.first / 3600].add(reading.second);
+    }
+  }
+  cout << "  hourly rollup from the side map: " << elapsedMs(start) << " ms"
+       << endl;
+  int threadCounts[] = {1, 2, 4};
+  for (int threads : threadCounts) {
+    vector<MeterAggregate> hours;
+    start = Clock::now();
+    wp.rollup(0, day, 3600, hours, threads);
+    cout << "  hourly rollup on " << threads << " threads: " << elapsedMs(start)
+         << " ms, " << hours[12].average() << " W average at noon" << endl;
+  }
+}
+
+void benchApplyBatch(TREETYPE type, int prefill, int batch, int ops) {
+  std::mt19937 generator(10);
+  std::uniform_int_distribution<int> ids(MINID, MAXID);
+  std::uniform_int_distribution<int> kinds(0, 1);
+  vector<int> prefillIds;
+  for (int i = 0; i < prefill; i++) {
+    prefillIds.push_back(ids(generator));
+  }
+  vector<CustomerDelta> deltas;
+  for (int i = 0; i < ops; i++) {
+    CustomerDelta delta = {kinds(generator) == 0 ? DELTA_INSERT : DELTA_REMOVE,
+                           ids(generator), 0, 0};
+    deltas.push_back(delta);
+  }
+  // each side gets a tree of its own built the same way, two trees built
+  // side by side interleave their nodes and the second one searches slower
+  double oneMs = 0;
+  double batchMs = 0;
+  for (int side = 0; side < 2; side++) {
+    WirelessPower wp(type);
+    for (int id : prefillIds) {
+      wp.insert(Customer(id, 0, 0));
+    }
+    vector<vector<CustomerDelta>> batches; // cut outside the timed loop
+    for (int i = 0; side == 1 && i < ops; i += batch) {
+      batches.push_back(vector<CustomerDelta>(
+          deltas.begin() + i, deltas.begin() + min(ops, i + batch)));
+    }
+    Clock::time_point start = Clock::now();
+    if (side == 0) {
+      for (const CustomerDelta &delta : deltas) {
+        if (delta.m_type == DELTA_INSERT) {
+          wp.insert(Customer(delta.m_id, 0, 0));
+        } else {
+          wp.remove(delta.m_id);
+        }
+      }
+      oneMs = elapsedMs(start);
+    } else {
+      for (vector<CustomerDelta> &changes : batches) {
+        wp.applyBatch(std::move(changes));
+      }
+      batchMs = elapsedMs(start);
+    }
+  }
+  cout << "  " << typeName(type) << ", batches of " << batch << ": " << oneMs
+       << " ms one by one, " << batchMs << " ms applyBatch ("
+       << oneMs / batchMs << "x)" << endl;
+}
+
+void benchSmallRegistries(TREETYPE type, int registries, bool small) {
+  std::mt19937 generator(10);
+  std::uniform_int_distribution<int> sizes(0, 32);
+  std::uniform_int_distribution<int> ids(MINID, MAXID);
+  size_t before = mallinfo2().uordblks;
+  vector<WirelessPower *> all;
+  vector<vector<int>> present(registries);
+  for (int i = 0; i < registries; i++) {
+    all.push_back(new WirelessPower(type));
+    all[i]->setSmall(small);
+    for (int size = sizes(generator); size > 0; size--) {
+      int id = ids(generator);
+      all[i]->insert(Customer(id, 0, 0));
+      present[i].push_back(id);
+    }
+  }
+  size_t bytes = mallinfo2().uordblks - before;
+
+  // half of the lookups hit, spread over every registry
+  int lookups = 2000000;
+  vector<pair<int, int>> probes;
+  std::uniform_int_distribution<int> pick(0, registries - 1);
+  for (int i = 0; i < lookups; i++) {
+    int registry = pick(generator);
+    int id = ids(generator);
+    if (i % 2 == 0 && !present[registry].empty()) {
+      id = present[registry][id % present[registry].size()];
+    }
+    probes.push_back(make_pair(registry, id));
+  }
+  Clock::time_point start = Clock::now();
+  int found = 0;
+  for (const pair<int, int> &probe : probes) {
+    found += all[probe.first]->touch(probe.second) ? 1 : 0;
+  }
+  double ms = elapsedMs(start);
+  cout << "  " << typeName(type) << (small ? " small" : " tree") << ": "
+       << (double)bytes / registries << " bytes per registry, "
+       << ms * 1e6 / lookups << " ns per lookup (" << found << " found)"
+       << endl;
+  for (WirelessPower *wp : all) {
+    delete wp;
+  }
+}
+
+// resident and proportional set size of this process in kB, a page shared
+// by n processes counts whole in each Rss but 1/n in each Pss
+void memoryKB(long long &rss, long long &pss) {
+  ifstream file("/proc/self/smaps_rollup");
+  string key;
+  long long value = 0;
+  rss = 0;
+  pss = 0;
+  getline(file, key); // the address range line
+  while (file >> key >> value) {
+    if (key == "Rss:") {
+      rss = value;
+    } else if (key == "Pss:") {
+      pss = value;
+    }
+    file.ignore(LLONG_MAX, '\n');
+  }
+}
+
+// one worker of benchSharedMemory, run as "bench memory-worker <shared>
+// <seed> <lookups> <ready fd> <measure fd> <leave fd>" so it starts out as a
+// clean process instead of a fork that inherits the heap of every earlier
+// bench
+int memoryWorker(char **argv) {
+  bool shared = atoi(argv[2]) != 0;
+  int seed = atoi(argv[3]);
+  int lookups = atoi(argv[4]);
+  int ready = atoi(argv[5]);
+  int measure = atoi(argv[6]);
+  int leave = atoi(argv[7]);
+  long long found = 0;
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<int> ids(MINID, MAXID);
+  SharedRegistry reader("/wpower_bench"); // not open without a segment
+  for (int j = 0; shared && j < lookups; j++) {
+    found += reader.contains(ids(generator)) ? 1 : 0;
+  }
+  WirelessPower own(AVL);
+  for (int id = MINID; !shared && id <= MAXID; id++) {
+    own.insert(Customer(id, 0, 0));
+  }
+  for (int j = 0; !shared && j < lookups; j++) {
+    found += own.touch(ids(generator)) ? 1 : 0;
+  }
+  char token = 0;
+  if (write(ready, "r", 1) != 1 || read(measure, &token, 1) != 1) {
+    return 1;
+  }
+  long long sizes[2] = {0, 0};
+  memoryKB(sizes[0], sizes[1]);
+  if (write(ready, sizes, sizeof(sizes)) != sizeof(sizes) ||
+      read(leave, &token, 1) != 1) {
+    return 1;
+  }
+  return found > 0 ? 0 : 1;
+}
+
+// starts workers that each hold every customer, either in a private AVL tree
+// or by mapping one shared segment, and sums their whole Rss and Pss
+void benchSharedMemory(int workers, bool shared, int lookups) {
+  string name = "/wpower_bench";
+  SharedRegistry *writer = nullptr;
+  if (shared) {
+    WirelessPower wp(AVL);
+    for (int id = MINID; id <= MAXID; id++) {
+      wp.insert(Customer(id, 0, 0));
+    }
+    writer = new SharedRegistry(name, MAXID - MINID + 1);
+    writer->load(wp);
+  }
+  // workers report ready once populated, measure together once all are, and
+  // stay alive until every measurement is in so their pages overlap
+  int ready[2];
+  int measure[2];
+  int leave[2];
+  if (pipe(ready) != 0 || pipe(measure) != 0 || pipe(leave) != 0) {
+    return;
+  }
+  int started = 0;
+  for (int i = 0; i < workers; i++) {
+    vector<string> args = {"bench",
+                           "memory-worker",
+                           shared ? "1" : "0",
+                           to_string(i),
+                           to_string(lookups),
+                           to_string(ready[1]),
+                           to_string(measure[0]),
+                           to_string(leave[0])};
+    vector<char *> argv;
+    for (string &arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+      execv("/proc/self/exe", argv.data());
+      _exit(1);
+    }
+    started += (pid > 0) ? 1 : 0;
+  }
+  for (int i = 0; i < started; i++) {
+    char token = 0;
+    if (read(ready[0], &token, 1) != 1) {
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    if (write(measure[1], "m", 1) != 1) {
+      break;
+    }
+  }
+  long long rssKB = 0;
+  long long pssKB = 0;
+  for (int i = 0; i < started; i++) {
+    long long sizes[2] = {0, 0};
+    if (read(ready[0], sizes, sizeof(sizes)) == sizeof(sizes)) {
+      rssKB += sizes[0];
+      pssKB += sizes[1];
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    if (write(leave[1], "x", 1) != 1) {
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    wait(nullptr);
+  }
+  for (int fd : {ready[0], ready[1], measure[0], measure[1], leave[0],
+                 leave[1]}) {
+    close(fd);
+  }
+  cout << "  " << (shared ? "one shared segment" : "a tree per worker")
+       << ": " << rssKB / 1024 << " MB Rss, " << pssKB / 1024
+       << " MB Pss summed over " << started << " workers";
+  if (shared) {
+    cout << " (segment " << writer->bytes() / (1024 * 1024) << " MB)";
+    delete writer;
+    SharedRegistry::unlink(name);
+  }
+  cout << endl;
+}
+
+// one writer process churns the segment while readers search it
+void benchSharedChurn(int readers, int writes, int lookups) {
+  string name = "/wpower_bench";
+  SharedRegistry writer(name, MAXID - MINID + 1);
+  for (int id = MINID; id <= MAXID; id += 2) {
+    writer.insert(Customer(id, 0, 0));
+  }
+  int results[2];
+  if (pipe(results) != 0) {
+    return;
+  }
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < readers; i++) {
+    if (fork() == 0) {
+      SharedRegistry reader(name);
+      std::mt19937 generator(i);
+      std::uniform_int_distribution<int> ids(MINID, MAXID);
+      long long found = 0;
+      for (int j = 0; j < lookups; j++) {
+        found += reader.contains(ids(generator)) ? 1 : 0;
+      }
+      long long retries = reader.retries();
+      if (write(results[1], &retries, sizeof(retries)) != sizeof(retries)) {
+        _exit(1);
+      }
+      _exit(found > 0 ? 0 : 1);
+    }
+  }
+  std::mt19937 generator(10);
+  std::uniform_int_distribution<int> ids(MINID, MAXID);
+  for (int i = 0; i < writes; i++) {
+    int id = ids(generator);
+    if (i % 2 == 0) {
+      writer.insert(Customer(id, 0, 0));
+    } else {
+      writer.remove(id);
+    }
+  }
+  long long retries = 0;
+  for (int i = 0; i < readers; i++) {
+    long long count = 0;
+    if (read(results[0], &count, sizeof(count)) == sizeof(count)) {
+      retries += count;
+    }
+    wait(nullptr);
+  }
+  double ms = elapsedMs(start);
+  close(results[0]);
+  close(results[1]);
+  cout << "  " << readers << " readers, " << writes << " writes: " << ms
+       << " ms, " << (readers * (double)lookups / ms) * 1000.0
+       << " lookups/s, " << 100.0 * retries / (readers * (double)lookups)
+       << "% retried" << endl;
+  SharedRegistry::unlink(name);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 8 && strcmp(argv[1], "memory-worker") == 0) {
+    return memoryWorker(argv);
+  }
+  int prefill = 50000;
+  int ops = 1000000;
+  cout << "Mixed 50/50 insert/remove, " << prefill << " prefill, " << ops
+       << " ops:" << endl;
+  TREETYPE types[] = {AVL, REDBLACK};
+  for (TREETYPE type : types) {
+    double ms = benchMixed(type, prefill, ops);
+    cout << "  " << typeName(type) << ": " << ms << " ms ("
+         << (ops / ms) * 1000.0 << " ops/s)" << endl;
+  }
+
+  cout << "setType(AVL) on a " << MAXID - MINID + 1 << " node BST:" << endl;
+  int budgets[] = {0, 4, 16, 64};
+  for (int budget : budgets) {
+    benchConversion(budget, false);
+  }
+  for (int budget : budgets) {
+    benchConversion(budget, true);
+  }
+
+  int loggedOps = 200000;
+  cout << "Mutation log overhead, " << loggedOps << " ops:" << endl;
+  cout << "  in memory only:" << endl;
+  benchLogged(loggedOps, -1);
+  int commitBudgets[] = {100, 1000, 10000};
+  for (int commitMicros : commitBudgets) {
+    cout << "  group commit " << commitMicros << " us:" << endl;
+    benchLogged(loggedOps, commitMicros);
+  }
+  int syncOps = 2000;
+  cout << "  fsync every op (" << syncOps << " ops):" << endl;
+  benchLogged(syncOps, 0);
+
+  cout << "Registry diff, " << MAXID - MINID + 1 << " customers:" << endl;
+  int changeCounts[] = {0, 10, 1000};
+  for (int changes : changeCounts) {
+    benchDiff(changes, true);
+    benchDiff(changes, false);
+  }
+
+  benchVerify();
+
+  cout << "Contended writers, " << std::thread::hardware_concurrency()
+       << " hardware threads:" << endl;
+  int threadCounts[] = {1, 8, 32, 64};
+  for (int threads : threadCounts) {
+    int ops = 200000 / threads;
+    benchContention(threads, ops, false, 1);
+    benchContention(threads, ops, true, 1);
+    benchContention(threads, ops, true, 64);
+  }
+
+  benchTiles(10);
+
+  cout << "Remove 30000 of 90000 ids:" << endl;
+  benchRemoveRange(AVL, 90000, 30000);
+  benchRemoveRange(REDBLACK, 90000, 30000);
+
+  vector<int> trace = zipfTrace(MAXID - MINID + 1, 0.99, 1000000);
+  cout << "Zipfian cache, skew 0.99, " << trace.size() << " accesses:" << endl;
+  int capacities[] = {1000, 10000};
+  for (int capacity : capacities) {
+    benchSplayCache(capacity, trace);
+  }
+
+  int rounds = 11;
+  cout << "Sequential onboarding, " << rounds * (MAXID - MINID + 1)
+       << " inserts:" << endl;
+  benchSequentialInsert(AVL, rounds);
+  benchSequentialInsert(REDBLACK, rounds);
+  benchSequentialInsert(SPLAY, rounds);
+
+  benchCompact();
+
+  cout << "Profiling overhead, 500000 inserts and removes:" << endl;
+  benchProfiling(AVL, 500000);
+  benchProfiling(SPLAY, 500000);
+
+  cout << "Concurrent lookups, inserts and removes, "
+       << std::thread::hardware_concurrency() << " hardware threads:" << endl;
+  for (int threads : threadCounts) {
+    int ops = 1000000 / threads;
+    benchSkipList(AVL, threads, ops);
+    benchSkipList(SKIPLIST, threads, ops);
+  }
+
+  cout << "Splay policies, skew 0.99, " << trace.size() << " touches:" << endl;
+  benchSplayPolicy(trace, SPLAY_FULL, 0, "full");
+  benchSplayPolicy(trace, SPLAY_RANDOM, 1, "top-down full");
+  benchSplayPolicy(trace, SPLAY_SEMI, 0, "semi");
+  benchSplayPolicy(trace, SPLAY_DEPTH, 8, "depth > 8");
+  benchSplayPolicy(trace, SPLAY_DEPTH, 12, "depth > 12");
+  benchSplayPolicy(trace, SPLAY_RANDOM, 0.1, "random 0.1");
+  benchSplayPolicy(trace, SPLAY_RANDOM, 0.01, "random 0.01");
+
+  cout << "Metering store, " << MAXID - MINID + 1 << " customers:" << endl;
+  benchMetering();
+
+  cout << "Mixed change sets, 50000 prefill, 200000 ops:" << endl;
+  int batchSizes[] = {10, 100, 1000, 10000};
+  for (int batch : batchSizes) {
+    benchApplyBatch(AVL, 50000, batch, 200000);
+    benchApplyBatch(REDBLACK, 50000, batch, 200000);
+  }
+
+  cout << "100000 registries of 0-32 customers:" << endl;
+  benchSmallRegistries(AVL, 100000, false);
+  benchSmallRegistries(AVL, 100000, true);
+  benchSmallRegistries(REDBLACK, 100000, false);
+  benchSmallRegistries(REDBLACK, 100000, true);
+
+  cout << "32 worker processes holding " << MAXID - MINID + 1
+       << " customers:" << endl;
+  benchSharedMemory(32, false, 100000);
+  benchSharedMemory(32, true, 100000);
+  benchSharedChurn(8, 200000, 500000);
+  return 0;
+}
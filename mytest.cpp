@@ -1,108 +1,25 @@
+#include "wpcombine.h"
+#include "wplog.h"
+#include "wpmeter.h"
+#include "wprandom.h"
+#include "wpshared.h"
+#include "wpsmall.h"
+#include "wpstats.h"
+#include "wptiles.h"
+#include "wptrace.h"
 #include "wpower.h"
 #include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
 #include <math.h>
 #include <random>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
-enum RANDOM { UNIFORMINT, UNIFORMREAL, NORMAL, SHUFFLE };
-class Random {
-public:
-  Random(int min, int max, RANDOM type = UNIFORMINT, int mean = 50,
-         int stdev = 20)
-      : m_min(min), m_max(max), m_type(type) {
-    if (type == NORMAL) {
-      // the case of NORMAL to generate integer numbers with normal distribution
-      m_generator = std::mt19937(m_device());
-      // the data set will have the mean of 50 (default) and standard deviation
-      // of 20 (default) the mean and standard deviation can change by passing
-      // new values to constructor
-      m_normdist = std::normal_distribution<>(mean, stdev);
-    } else if (type == UNIFORMINT) {
-      // the case of UNIFORMINT to generate integer numbers
-      //  Using a fixed seed value generates always the same sequence
-      //  of pseudorandom numbers, e.g. reproducing scientific experiments
-      //  here it helps us with testing since the same sequence repeats
-      m_generator = std::mt19937(10); // 10 is the fixed seed value
-      m_unidist = std::uniform_int_distribution<>(min, max);
-    } else if (type == UNIFORMREAL) { // the case of UNIFORMREAL to generate
-                                      // real numbers
-      m_generator = std::mt19937(10); // 10 is the fixed seed value
-      m_uniReal =
-          std::uniform_real_distribution<double>((double)min, (double)max);
-    } else { // the case of SHUFFLE to generate every number only once
-      m_generator = std::mt19937(m_device());
-    }
-  }
-  void setSeed(int seedNum) {
-    // we have set a default value for seed in constructor
-    // we can change the seed by calling this function after constructor call
-    // this gives us more randomness
-    m_generator = std::mt19937(seedNum);
-  }
-  void getShuffle(vector<int> &array) {
-    // the user program creates the vector param and passes here
-    // here we populate the vector using m_min and m_max
-    for (int i = m_min; i <= m_max; i++) {
-      array.push_back(i);
-    }
-    shuffle(array.begin(), array.end(), m_generator);
-  }
-
-  void getShuffle(int array[]) {
-    // the param array must be of the size (m_max-m_min+1)
-    // the user program creates the array and pass it here
-    vector<int> temp;
-    for (int i = m_min; i <= m_max; i++) {
-      temp.push_back(i);
-    }
-    std::shuffle(temp.begin(), temp.end(), m_generator);
-    vector<int>::iterator it;
-    int i = 0;
-    for (it = temp.begin(); it != temp.end(); it++) {
-      array[i] = *it;
-      i++;
-    }
-  }
-
-  int getRandNum() {
-    // this function returns integer numbers
-    // the object must have been initialized to generate integers
-    int result = 0;
-    if (m_type == NORMAL) {
-      // returns a random number in a set with normal distribution
-      // we limit random numbers by the min and max values
-      result = m_min - 1;
-      while (result < m_min || result > m_max)
-        result = m_normdist(m_generator);
-    } else if (m_type == UNIFORMINT) {
-      // this will generate a random number between min and max values
-      result = m_unidist(m_generator);
-    }
-    return result;
-  }
-
-  double getRealRandNum() {
-    // this function returns real numbers
-    // the object must have been initialized to generate real numbers
-    double result = m_uniReal(m_generator);
-    // a trick to return numbers only with two deciaml points
-    // for example if result is 15.0378, function returns 15.03
-    // to round up we can use ceil function instead of floor
-    result = std::floor(result * 100.0) / 100.0;
-    return result;
-  }
-
-private:
-  int m_min;
-  int m_max;
-  RANDOM m_type;
-  std::random_device m_device;
-  std::mt19937 m_generator;
-  std::normal_distribution<> m_normdist;     // normal distribution
-  std::uniform_int_distribution<> m_unidist; // integer uniform distribution
-  std::uniform_real_distribution<double> m_uniReal; // real uniform distribution
-};
-
 class Tester {
 private:
   Random idGen;
@@ -293,6 +210,1201 @@ public:
     ewp1 = ewp2;
     return (ewp1 == ewp2);
   }
+  bool testRedBlackInsert() {
+    WirelessPower wp(REDBLACK);
+    int size = 300;
+    bool pass = true;
+
+    for (int i = 0; i < size; i++) {
+      int id = idGen.getRandNum();
+      double lat = latGen.getRandNum();
+      double lon = longGen.getRandNum();
+
+      Customer customer(id, lat, lon);
+      wp.insert(customer);
+      pass = pass && wp.find(id);
+    }
+    Customer *root = wp.getRoot();
+    return pass && wp.checkRedBlack() && wp.checkPreservance() &&
+           wp.checkHeight(root);
+  }
+  bool testRedBlackRemove() {
+    WirelessPower wp(REDBLACK);
+    int size = 300;
+    int numRemove = 134;
+    int ids[size + 1];
+    bool pass = true;
+
+    for (int i = 0; i < size; i++) {
+      int id = idGen.getRandNum();
+      double lat = latGen.getRandNum();
+      double lon = longGen.getRandNum();
+
+      Customer customer(id, lat, lon);
+      wp.insert(customer);
+      ids[i] = id;
+    }
+
+    for (int i = 0; i < size - numRemove; i++) {
+      wp.remove(ids[i]);
+      pass = pass && !wp.find(ids[i]) && wp.checkRedBlack();
+    }
+    Customer *root = wp.getRoot();
+    return pass && wp.checkPreservance() && wp.checkHeight(root);
+  }
+  bool testSetTypeRedBlack() {
+    WirelessPower wp(BST);
+    int size = 200;
+
+    for (int i = 0; i < size; i++) { // sorted ids, degenerate BST
+      Customer customer(MINID + i, latGen.getRandNum(), longGen.getRandNum());
+      wp.insert(customer);
+    }
+    wp.setType(REDBLACK);
+    bool pass = wp.checkRedBlack() && wp.checkPreservance();
+    for (int i = 0; i < size; i += 2) {
+      wp.remove(MINID + i);
+    }
+    pass = pass && wp.checkRedBlack();
+    wp.setType(AVL);
+    pass = pass && wp.checkBalance() && wp.checkPreservance();
+    for (int i = 1; i < size; i += 2) {
+      pass = pass && wp.find(MINID + i);
+    }
+    return pass;
+  }
+  bool testIncrementalSetType() {
+    WirelessPower wp(BST);
+    int size = 500;
+    int budget = 4;
+    vector<int> ids;
+    bool pass = true;
+
+    for (int i = 0; i < size; i++) { // decreasing ids, left leaning BST
+      Customer customer(MAXID - i, latGen.getRandNum(), longGen.getRandNum());
+      wp.insert(customer);
+    }
+    wp.setType(AVL, budget);
+    pass = pass && wp.isConverting() && wp.getType() == AVL;
+    while (wp.isConverting()) {
+      wp.remove(MAXID - idGen.getRandNum() % size);
+      int id = idGen.getRandNum();
+      Customer customer(id, latGen.getRandNum(), longGen.getRandNum());
+      wp.insert(customer);
+      ids.push_back(id);
+      pass = pass && wp.find(id) && wp.checkBalance() && wp.checkPreservance();
+    }
+    for (int i = 0; i < (int)ids.size(); i++) {
+      wp.remove(ids[i]);
+      pass = pass && !wp.find(ids[i]);
+    }
+    // each pending customer takes one step to reach and one to move
+    Customer *root = wp.getRoot();
+    return pass && (int)ids.size() <= 2 * size / budget + 1 &&
+           wp.checkBalance() && wp.checkPreservance() && wp.checkHeight(root);
+  }
+  bool testBoundedConversion() {
+    int size = 2000;
+    int budget = 4;
+    // log2(4000) is 12, so no AVL path is longer than 18 nodes, and a call
+    // walks one path to change the tree plus two per conversion step
+    int bound = (1 + 3 * budget) * 18;
+    bool pass = true;
+    for (int leaning = 0; leaning < 2; leaning++) {
+      WirelessPower wp(BST);
+      map<int, double> expected;
+      for (int i = 0; i < size; i++) { // a chain, left or right leaning
+        int id = (leaning == 0) ? MINID + i : MINID + size - 1 - i;
+        wp.insert(Customer(id, id % 90, 0));
+        expected[id] = id % 90;
+      }
+      wp.setType(AVL, budget);
+      int worst = 0;
+      for (int op = 0; wp.isConverting(); op++) {
+        int id = MINID + idGen.getRandNum() % (2 * size);
+        wp.m_visits = 0;
+        if (op % 2 == 0) {
+          wp.insert(Customer(id, op % 90, 0));
+          expected.insert(make_pair(id, op % 90));
+        } else {
+          wp.remove(id);
+          expected.erase(id);
+        }
+        worst = max(worst, wp.m_visits);
+        pass = pass && wp.find(id) == (expected.count(id) == 1);
+        if (op % 97 == 0) { // the reads see through the pending changes
+          int low = MINID + idGen.getRandNum() % size;
+          int count = distance(expected.lower_bound(low),
+                               expected.upper_bound(low + size / 4));
+          pass = pass && wp.verify() &&
+                 wp.rank(low) == distance(expected.begin(),
+                                          expected.lower_bound(low)) &&
+                 wp.countRange(low, low + size / 4) == count;
+        }
+      }
+      vector<Customer *> nodes;
+      wp.contents(nodes);
+      pass = pass && worst <= bound && wp.verify() &&
+             nodes.size() == expected.size();
+      for (Customer *customer : nodes) {
+        map<int, double>::iterator found = expected.find(customer->getID());
+        pass = pass && found != expected.end() &&
+               found->second == customer->getLatitude();
+        delete customer;
+      }
+    }
+    return pass;
+  }
+  bool testMutationLogReplay() {
+    string path = "mytest.wal";
+    std::remove(path.c_str());
+    std::remove((path + ".snap").c_str());
+    WirelessPower wp(AVL);
+    int size = 300;
+    int ids[size];
+    {
+      MutationLog log(path, 500);
+      wp.attachLog(&log);
+      for (int i = 0; i < size; i++) {
+        ids[i] = idGen.getRandNum();
+        Customer customer(ids[i], latGen.getRandNum(), longGen.getRandNum());
+        wp.insert(customer);
+      }
+      log.compact(wp); // half of the history goes into the snapshot
+      for (int i = 0; i < size; i += 3) {
+        wp.remove(ids[i]);
+      }
+      wp.attachLog(nullptr);
+    }
+    WirelessPower copy(AVL);
+    MutationLog log(path);
+    bool pass = log.replay(copy) > 0 && copy.checkBalance();
+    for (int i = 0; i < size; i++) {
+      pass = pass && copy.find(ids[i]) == wp.find(ids[i]);
+    }
+    // into a registry that is not empty the folds go in as one batch
+    WirelessPower partial(AVL);
+    for (int i = 0; i < 10; i++) {
+      partial.insert(Customer(ids[i], 0, 0));
+    }
+    pass = pass && log.replay(partial) > 0 && partial.checkBalance();
+    for (int i = 0; i < size; i++) {
+      pass = pass && partial.find(ids[i]) == wp.find(ids[i]);
+    }
+
+    // a corrupted last record is dropped when the log is opened again
+    {
+      MutationLog append(path, 0);
+      append.logRemove(ids[1]);
+    }
+    fstream file(path.c_str(), ios::in | ios::out | ios::binary);
+    file.seekp(-1, ios::end);
+    file.put('x');
+    file.close();
+    WirelessPower torn(AVL);
+    MutationLog reopened(path);
+    pass = pass && reopened.replay(torn) > 0 &&
+           torn.find(ids[1]) == wp.find(ids[1]);
+
+    // a failed write latches the log and every later append is refused
+    {
+      MutationLog failing(path, 0);
+      close(failing.m_fd);
+      failing.m_fd = open(path.c_str(), O_RDONLY);
+      pass = pass && !failing.hasFailed() && !failing.logRemove(ids[2]) &&
+             failing.hasFailed() && !failing.logRemove(ids[3]) &&
+             !failing.commit();
+    }
+    pass = pass && reopened.replay(torn) > 0 &&
+           torn.find(ids[2]) == wp.find(ids[2]);
+
+    // a splay tree keeps a removed customer, so the log must keep it too
+    std::remove(path.c_str());
+    std::remove((path + ".snap").c_str());
+    {
+      WirelessPower splay(SPLAY);
+      MutationLog splayLog(path, 0);
+      splay.attachLog(&splayLog);
+      splay.insert(Customer(ids[0], 0, 0));
+      splay.remove(ids[0]);
+      splay.attachLog(nullptr);
+      pass = pass && splay.find(ids[0]);
+    }
+    WirelessPower recovered(SPLAY);
+    MutationLog splayLog(path);
+    pass = pass && splayLog.replay(recovered) > 0 &&
+           recovered.find(ids[0]);
+
+    std::remove(path.c_str());
+    std::remove((path + ".snap").c_str());
+    return pass;
+  }
+  bool testMerkleDiff() {
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type);
+      WirelessPower replica(AVL);
+      wp.setHashing(true);
+      replica.setHashing(true);
+      int size = 300;
+      int ids[size];
+      for (int i = 0; i < size; i++) {
+        ids[i] = idGen.getRandNum();
+        Customer customer(ids[i], latGen.getRandNum(), longGen.getRandNum());
+        wp.insert(customer);
+      }
+      for (int i = size - 1; i >= 0; i--) { // other order, other shape
+        Customer copy = *wp.findNode(ids[i]);
+        replica.insert(Customer(copy.getID(), copy.getLatitude(),
+                                copy.getLongitude()));
+      }
+      pass = pass && wp == replica && wp.checkHashes(wp.getRoot());
+
+      // one removal, one new customer and one moved customer
+      if (type != SPLAY) {
+        wp.remove(ids[0]);
+      }
+      int newID = idGen.getRandNum();
+      while (wp.find(newID)) {
+        newID = idGen.getRandNum();
+      }
+      wp.insert(Customer(newID, 1, 1));
+      replica.remove(ids[1]);
+      replica.insert(Customer(ids[1], 45, 45));
+      pass = pass && !(wp == replica) && wp.checkHashes(wp.getRoot());
+
+      vector<CustomerDelta> delta;
+      replica.diff(wp, delta);
+      int expected = (type != SPLAY) ? 3 : 2;
+      pass = pass && (int)delta.size() == expected;
+      for (const CustomerDelta &change : delta) {
+        if (change.m_type != DELTA_INSERT) {
+          replica.remove(change.m_id);
+        }
+        if (change.m_type != DELTA_REMOVE) {
+          replica.insert(
+              Customer(change.m_id, change.m_latitude, change.m_longitude));
+        }
+      }
+      pass = pass && wp == replica;
+      delta.clear();
+      wp.diff(replica, delta);
+      pass = pass && delta.empty();
+    }
+
+    // without hashes every storage compares ids and locations, and a skip
+    // list diffs like a tree
+    WirelessPower tree(BST);
+    WirelessPower skip(SKIPLIST);
+    WirelessPower small(AVL);
+    small.setSmall(true);
+    for (int i = 0; i < 20; i++) {
+      Customer customer(MINID + 7 * i, 10 + i, 20 + i);
+      tree.insert(customer);
+      skip.insert(customer);
+      small.insert(customer);
+    }
+    pass = pass && tree == skip && skip == small && small == tree;
+    skip.remove(MINID);
+    skip.insert(Customer(MINID, 45, 45));
+    small.remove(MINID + 7);
+    pass = pass && !(tree == skip) && !(skip == tree) && !(tree == small);
+    vector<CustomerDelta> delta;
+    tree.diff(skip, delta);
+    pass = pass && delta.size() == 1 && delta[0].m_type == DELTA_UPDATE &&
+           delta[0].m_id == MINID;
+    delta.clear();
+    skip.diff(small, delta);
+    pass = pass && delta.size() == 2;
+    return pass;
+  }
+  bool testVerify() {
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type);
+      wp.setHashing(type == AVL);
+      int size = 1000;
+      for (int i = 0; i < size; i++) {
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+      }
+      pass = pass && wp.verify() && wp.verify(4) && wp.verifySample(50);
+
+      // the largest id left of the root is moved above the root, every
+      // parent and child pair still looks ordered
+      Customer *max = wp.getRoot()->getLeft();
+      while (max->getRight() != nullptr) {
+        max = max->getRight();
+      }
+      int oldID = max->getID();
+      max->setID(wp.getRoot()->getID() + 1);
+      bool found = wp.checkPreservance() && !wp.verify() && !wp.verify(4);
+      max->setID(oldID);
+      pass = pass && found && wp.verify();
+    }
+    return pass;
+  }
+  bool testCombiningWriters() {
+    WirelessPower wp(AVL);
+    int threads = 8;
+    int perThread = 500;
+    atomic<int> changed(0);
+    {
+      CombiningWirelessPower combiner(wp);
+      vector<thread> writers;
+      for (int t = 0; t < threads; t++) {
+        writers.push_back(thread([&combiner, &changed, t, perThread]() {
+          int first = MINID + t * perThread; // disjoint ids per thread
+          vector<future<bool>> results;
+          for (int i = 0; i < perThread; i++) {
+            results.push_back(combiner.insertAsync(Customer(first + i, 0, 0)));
+          }
+          for (int i = 0; i < perThread; i += 2) {
+            results.push_back(combiner.removeAsync(first + i));
+          }
+          changed += combiner.insert(Customer(first, 0, 0)) ? 1 : 0;
+          for (future<bool> &result : results) {
+            changed += result.get() ? 1 : 0;
+          }
+        }));
+      }
+      for (thread &writer : writers) {
+        writer.join();
+      }
+      // a present id is not inserted again, an absent one not removed
+      future<bool> again = combiner.insertAsync(Customer(MINID + 1, 0, 0));
+      future<bool> absent = combiner.removeAsync(MINID + 2);
+      future<bool> removed = combiner.removeAsync(MINID + 1);
+      changed += (again.get() || absent.get() || !removed.get()) ? 1 : 0;
+      combiner.insert(Customer(MINID + 1, 0, 0));
+    }
+    bool pass = changed == threads * (perThread + perThread / 2 + 1);
+    for (int t = 0; t < threads; t++) {
+      int first = MINID + t * perThread;
+      for (int i = 0; i < perThread; i++) {
+        pass = pass && wp.find(first + i) == (i == 0 || i % 2 == 1);
+      }
+    }
+    return pass && wp.verify();
+  }
+  bool testTileCounts() {
+    WirelessPower wp(AVL);
+    Random realLat(MINLAT, MAXLAT, UNIFORMREAL);
+    Random realLong(MINLONG, MAXLONG, UNIFORMREAL);
+    int size = 2000;
+    int levels = 6;
+    for (int i = 0; i < size / 2; i++) {
+      Customer customer(idGen.getRandNum(), realLat.getRealRandNum(),
+                        realLong.getRealRandNum());
+      wp.insert(customer);
+    }
+    wp.setTiling(levels); // counts what is already there
+    for (int i = size / 2; i < size; i++) {
+      Customer customer(idGen.getRandNum(), realLat.getRealRandNum(),
+                        realLong.getRealRandNum());
+      wp.insert(customer);
+    }
+    for (int i = 0; i < 100; i++) {
+      int id = idGen.getRandNum();
+      wp.remove(id);
+      wp.updateLocation(idGen.getRandNum(), realLat.getRealRandNum(),
+                        realLong.getRealRandNum());
+    }
+
+    // compare every query against a scan of the tree
+    vector<Customer *> customers;
+    wp.flatten(wp.getRoot(), customers);
+    const TileCounts *tiles = wp.getTiles();
+    bool pass = tiles->count(0, 0, 0) == (int)customers.size();
+    for (int query = 0; query < 50; query++) {
+      int level = query % levels;
+      double lat1 = realLat.getRealRandNum();
+      double lat2 = realLat.getRealRandNum();
+      double long1 = realLong.getRealRandNum();
+      double long2 = realLong.getRealRandNum();
+      int minRow, minCol, maxRow, maxCol;
+      tiles->tileOf(level, min(lat1, lat2), min(long1, long2), minRow, minCol);
+      tiles->tileOf(level, max(lat1, lat2), max(long1, long2), maxRow, maxCol);
+      int expected = 0;
+      for (Customer *customer : customers) {
+        int row, col;
+        tiles->tileOf(level, customer->getLatitude(),
+                      customer->getLongitude(), row, col);
+        if (row >= minRow && row <= maxRow && col >= minCol && col <= maxCol) {
+          expected++;
+        }
+      }
+      int counted = tiles->countInBox(level, min(lat1, lat2), min(long1, long2),
+                                      max(lat1, lat2), max(long1, long2));
+      pass = pass && counted == expected;
+    }
+
+    // out of range level counts are clamped instead of overflowing
+    TileCounts deep(40);
+    TileCounts none(-3);
+    pass = pass && deep.levels() == MAX_TILE_LEVELS && none.levels() == 0 &&
+           deep.count(MAX_TILE_LEVELS - 1, 0, 0) == 0;
+    wp.setTiling(-1);
+    return pass && wp.getTiles() == nullptr;
+  }
+  bool testRemoveRangeBatch() {
+    TREETYPE types[] = {BST, AVL, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type);
+      wp.setHashing(type == AVL);
+      wp.setTiling(4);
+      vector<int> ids;
+      for (int i = 0; i < 2000; i++) {
+        int id = idGen.getRandNum();
+        Customer customer(id, latGen.getRandNum(), longGen.getRandNum());
+        wp.insert(customer);
+        ids.push_back(id);
+      }
+      int low = MINID + (MAXID - MINID) / 4;
+      int high = MINID + (MAXID - MINID) / 2;
+      wp.removeRange(low, high);
+      pass = pass && wp.verify();
+
+      // every third id goes in one batch, with a duplicate and a missing id
+      vector<int> batch;
+      for (int i = 0; i < (int)ids.size(); i += 3) {
+        batch.push_back(ids[i]);
+      }
+      batch.push_back(ids[0]);
+      batch.push_back(MAXID + 1);
+      wp.removeBatch(batch);
+      pass = pass && wp.verify();
+
+      sort(batch.begin(), batch.end());
+      int remaining = 0;
+      sort(ids.begin(), ids.end());
+      ids.erase(unique(ids.begin(), ids.end()), ids.end());
+      for (int id : ids) {
+        bool gone = (id >= low && id <= high) ||
+                    binary_search(batch.begin(), batch.end(), id);
+        pass = pass && (wp.find(id) != gone);
+        remaining += gone ? 0 : 1;
+      }
+      pass = pass && wp.getTiles()->count(0, 0, 0) == remaining;
+    }
+    return pass;
+  }
+  bool testOrderStatistics() {
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type == REDBLACK ? REDBLACK : BST);
+      for (int i = 0; i < 500; i++) {
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+      }
+      wp.setCounting(true); // sizes what is already there
+      if (type == AVL) {
+        wp.setType(AVL, 4); // sizes survive an incremental conversion
+      } else {
+        wp.setType(type);
+      }
+      for (int i = 0; i < 1500; i++) {
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+        wp.remove(idGen.getRandNum());
+      }
+      wp.removeRange(MINID, MINID + 1000);
+      pass = pass && wp.verify();
+
+      // compare against the sorted ids
+      vector<Customer *> customers;
+      wp.flatten(wp.getRoot(), customers);
+      vector<int> ids;
+      for (Customer *customer : customers) {
+        ids.push_back(customer->getID());
+      }
+      int size = (int)ids.size();
+      for (int k = 0; k < size; k += 7) {
+        pass = pass && wp.select(k) == ids[k] && wp.rank(ids[k]) == k &&
+               wp.rank(ids[k] + 1) == k + 1;
+      }
+      pass = pass && wp.select(size) == DEFAULT_ID &&
+             wp.select(-1) == DEFAULT_ID;
+      pass = pass && wp.countRange(MINID, MAXID) == size &&
+             wp.countRange(ids[size / 4], ids[size / 2]) ==
+                 size / 2 - size / 4 + 1;
+    }
+    return pass;
+  }
+  bool testSplayCapacity() {
+    string path = "mytest.trace";
+    WirelessPower wp(SPLAY);
+    wp.setTiling(2);
+    TraceRecorder trace(path);
+    wp.attachTrace(&trace);
+    int capacity = 100;
+    bool pass = true;
+    for (int i = 0; i < 2000; i++) {
+      Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                        longGen.getRandNum());
+      wp.insert(customer);
+      int size = wp.countRange(MINID, MAXID);
+      pass = pass && wp.touch(customer.getID()) &&
+             wp.getRoot()->getID() == customer.getID() &&
+             (i < capacity || size <= capacity + capacity / 8) &&
+             wp.getTiles()->count(0, 0, 0) == size;
+      if (i == capacity) {
+        wp.setCapacity(capacity); // evicts right away
+        pass = pass && wp.countRange(MINID, MAXID) <= capacity;
+      }
+    }
+
+    // the replay evicts the same customers on its own
+    wp.attachTrace(nullptr);
+    trace.flush();
+    vector<TraceRecord> records;
+    WirelessPower replayed(AVL);
+    pass = pass && TraceRecorder::read(path, records);
+    for (const TraceRecord &record : records) {
+      pass = pass && record.m_op != TRACE_REMOVE;
+      TraceRecorder::apply(record, replayed);
+    }
+    std::remove(path.c_str());
+    return pass && wp.verify() && replayed == wp;
+  }
+  bool testTraceReplay() {
+    string path = "mytest.trace";
+    WirelessPower wp(BST);
+    wp.setHashing(true);
+    for (int i = 0; i < 100; i++) { // recorded as inserts when attached
+      Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                        longGen.getRandNum());
+      wp.insert(customer);
+    }
+    {
+      TraceRecorder trace(path);
+      wp.attachTrace(&trace);
+      for (int i = 0; i < 300; i++) {
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+        wp.touch(idGen.getRandNum());
+        if (i % 3 == 0) {
+          wp.remove(idGen.getRandNum());
+        }
+        if (i == 150) {
+          wp.setType(REDBLACK);
+        }
+      }
+      wp.removeRange(MINID, MINID + 5000);
+      wp.attachTrace(nullptr);
+    }
+    vector<TraceRecord> records;
+    bool pass = TraceRecorder::read(path, records) && !records.empty() &&
+                records[0].m_op == TRACE_SETTYPE && records[0].m_id == BST;
+    for (int i = 1; i < (int)records.size(); i++) {
+      pass = pass && records[i].m_micros >= records[i - 1].m_micros;
+    }
+    WirelessPower copy(AVL);
+    copy.setHashing(true);
+    for (const TraceRecord &record : records) {
+      TraceRecorder::apply(record, copy);
+    }
+    std::remove(path.c_str());
+    return pass && copy.getType() == REDBLACK && copy == wp && copy.verify();
+  }
+  bool testHintedInsert() {
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type);
+      wp.setHashing(type == AVL);
+      wp.setCounting(type == REDBLACK);
+      vector<int> ids;
+      for (int id = MINID + 1000; id < MINID + 3000; id += 2) { // increasing
+        ids.push_back(id);
+      }
+      for (int id = MINID + 999; id >= MINID; id -= 3) { // decreasing
+        ids.push_back(id);
+      }
+      for (int i = 0; i < 1000; i++) { // clustered around a moving point
+        ids.push_back(MINID + 20000 + i * 10 + idGen.getRandNum() % 50);
+      }
+      for (int i = 0; i < (int)ids.size(); i++) {
+        wp.insertHinted(Customer(ids[i], 0, 0));
+        if (i % 100 == 0) { // drops the hint
+          wp.remove(ids[i / 2]);
+          wp.insert(Customer(ids[i / 2], 0, 0));
+        }
+      }
+      wp.insertHinted(Customer(ids[0], 0, 0)); // duplicate
+      pass = pass && wp.verify();
+      sort(ids.begin(), ids.end());
+      ids.erase(unique(ids.begin(), ids.end()), ids.end());
+      for (int id : ids) {
+        pass = pass && wp.find(id);
+      }
+      pass = pass && wp.countRange(MINID, MAXID) == (int)ids.size();
+    }
+    return pass;
+  }
+  bool testCompact() {
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK};
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower wp(type);
+      WirelessPower expected(type);
+      wp.setHashing(true);
+      expected.setHashing(true);
+      for (int i = 0; i < 3000; i++) {
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+        expected.insert(customer);
+      }
+      wp.compact();
+      vector<Customer *> customers;
+      wp.flatten(wp.getRoot(), customers);
+      Customer *low = *min_element(customers.begin(), customers.end());
+      Customer *high = *max_element(customers.begin(), customers.end());
+      pass = pass && wp.verify() && wp == expected &&
+             high - low == (long)customers.size() - 1 && // one block
+             wp.m_blocks.size() == 1;
+
+      // moving subtrees while the tree keeps changing
+      int steps = 0;
+      bool more = true;
+      while (more) {
+        more = wp.compact(64);
+        steps++;
+        Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                          longGen.getRandNum());
+        wp.insert(customer);
+        expected.insert(customer);
+        int id = idGen.getRandNum();
+        wp.remove(id);
+        expected.remove(id);
+      }
+      pass = pass && steps > 10 && wp.verify() && wp == expected;
+      for (int i = 0; i < 2000; i++) { // frees nodes inside the blocks
+        int id = idGen.getRandNum();
+        wp.remove(id);
+        expected.remove(id);
+      }
+      pass = pass && wp.verify() && wp == expected;
+
+      // blocks belong to the registry, emptied ones go by the next compact
+      // and the rest with clear
+      wp.compact();
+      pass = pass && wp.m_blocks.size() == 1 && wp == expected;
+      wp.clear();
+      pass = pass && wp.m_blocks.empty();
+    }
+    return pass;
+  }
+  bool testSkipList() {
+    bool pass = true;
+    WirelessPower tree(AVL);
+    for (int i = 0; i < 3000; i++) {
+      tree.insert(Customer(idGen.getRandNum(), 0, 0));
+    }
+    WirelessPower expected(AVL);
+    expected = tree;
+    tree.setType(SKIPLIST);
+    pass = pass && tree.verify() && tree.getRoot() == nullptr;
+    WirelessPower copy(SKIPLIST);
+    copy = expected;
+    pass = pass && copy == tree;
+    tree.setHashing(true); // the shapes differ, compare contents
+    expected.setHashing(true);
+    tree.setType(AVL); // and back, built balanced
+    pass = pass && tree.verify() && tree.checkBalance() && tree == expected;
+
+    // writers on disjoint ids remove every other id they inserted while
+    // readers look ids up
+    WirelessPower wp(SKIPLIST);
+    int threads = 8;
+    int perThread = 2000;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+      workers.push_back(thread([&wp, t, perThread]() {
+        for (int i = 0; i < perThread; i++) {
+          wp.insert(Customer(MINID + t + i * 8, 0, 0));
+          if (i % 2 == 1) {
+            wp.remove(MINID + t + (i - 1) * 8);
+          }
+        }
+      }));
+      workers.push_back(thread([&wp, t, perThread]() {
+        for (int i = 0; i < perThread; i++) {
+          wp.touch(MINID + (t * 977 + i * 8) % (perThread * 8));
+        }
+      }));
+    }
+    for (thread &worker : workers) {
+      worker.join();
+    }
+    pass = pass && wp.verify();
+    for (int id = MINID; id < MINID + threads * perThread; id++) {
+      bool kept = ((id - MINID) / 8) % 2 == 1;
+      pass = pass && wp.find(id) == kept;
+    }
+    pass = pass && wp.countRange(MINID, MAXID) == threads * perThread / 2 &&
+           wp.countRange(MINID + 1, MINID + 15) == 8;
+    wp.setType(REDBLACK);
+    pass = pass && wp.verify() && wp.find(MINID + 8) && !wp.find(MINID);
+
+    // writers racing on the same few ids log in the order the list applies
+    // their calls, so replaying the log gives the same customers
+    string path = "mytest.wal";
+    std::remove(path.c_str());
+    WirelessPower logged(SKIPLIST);
+    {
+      MutationLog log(path);
+      logged.attachLog(&log);
+      vector<thread> writers;
+      for (int t = 0; t < 4; t++) {
+        writers.push_back(thread([&logged, t]() {
+          std::mt19937 generator(t);
+          for (int i = 0; i < 5000; i++) {
+            int id = MINID + generator() % 16;
+            if (generator() % 2 == 0) {
+              logged.insert(Customer(id, t, i));
+            } else {
+              logged.remove(id);
+            }
+          }
+        }));
+      }
+      for (thread &writer : writers) {
+        writer.join();
+      }
+      logged.attachLog(nullptr);
+    }
+    WirelessPower replayed(AVL);
+    MutationLog log(path);
+    pass = pass && log.replay(replayed) > 0 && replayed == logged;
+    std::remove(path.c_str());
+
+    // a removed customer's readings go with it, as in a tree
+    WirelessPower metered(AVL);
+    metered.setMetering(true);
+    metered.insert(Customer(MINID, 0, 0));
+    metered.addReading(MINID, 1, 5.0);
+    metered.setType(SKIPLIST);
+    metered.remove(MINID);
+    metered.insert(Customer(MINID, 0, 0));
+    pass = pass && metered.aggregate(MINID, 0, 10).m_count == 0;
+    return pass;
+  }
+  bool testSplayPolicies() {
+    auto depthOf = [](WirelessPower &wp, int id) {
+      int depth = 0;
+      const Customer *customer = wp.getRoot();
+      while (customer != nullptr && customer->getID() != id) {
+        customer = (id < customer->getID()) ? customer->getLeft()
+                                            : customer->getRight();
+        depth++;
+      }
+      return depth;
+    };
+    bool pass = true;
+    SPLAYPOLICY policies[] = {SPLAY_SEMI, SPLAY_DEPTH, SPLAY_RANDOM};
+    for (SPLAYPOLICY policy : policies) {
+      WirelessPower wp(SPLAY);
+      WirelessPower expected(BST);
+      wp.setHashing(true); // compares contents whatever the shapes
+      expected.setHashing(true);
+      wp.setSplayPolicy(policy, (policy == SPLAY_DEPTH) ? 6 : 0.5);
+      vector<int> ids;
+      for (int i = 0; i < 2000; i++) {
+        Customer customer(idGen.getRandNum(), 0, 0);
+        wp.insert(customer);
+        expected.insert(customer);
+        ids.push_back(customer.getID());
+      }
+      for (int i = 0; i < 2000; i++) {
+        pass = pass && wp.touch(ids[(i * 7919) % ids.size()]);
+      }
+      pass = pass && !wp.touch(MAXID + 1) && wp.verify() && wp == expected;
+
+      // one long path, built as a BST so nothing splays
+      WirelessPower path(BST);
+      for (int id = MINID; id < MINID + 64; id++) {
+        path.insert(Customer(id, 0, 0));
+      }
+      path.setType(SPLAY);
+      path.setSplayPolicy(policy, (policy == SPLAY_DEPTH) ? 10 : 0);
+      path.touch(MINID + 5); // shallow, and SPLAY_RANDOM never splays
+      pass = pass && (policy == SPLAY_SEMI || path.getRoot()->getID() == MINID);
+      path.touch(MINID + 63);
+      if (policy == SPLAY_SEMI) { // every zig-zig pair halves the path
+        pass = pass && depthOf(path, MINID + 63) <= 32;
+        // a path that turns at every node, zig-zag steps lift it by thirds
+        WirelessPower zigzag(BST);
+        for (int i = 0; i < 32; i++) {
+          zigzag.insert(Customer(MINID + i, 0, 0));
+          zigzag.insert(Customer(MINID + 100 - i, 0, 0));
+        }
+        zigzag.setType(SPLAY);
+        zigzag.setSplayPolicy(SPLAY_SEMI, 0);
+        int depth = depthOf(zigzag, MINID + 69);
+        zigzag.touch(MINID + 69);
+        int once = depthOf(zigzag, MINID + 69);
+        zigzag.touch(MINID + 69);
+        pass = pass && depth == 63 && once <= 44 &&
+               depthOf(zigzag, MINID + 69) < once && zigzag.verify();
+      } else if (policy == SPLAY_DEPTH) {
+        pass = pass && path.getRoot()->getID() == MINID + 63;
+      } else {
+        pass = pass && path.getRoot()->getID() == MINID;
+        path.setSplayPolicy(SPLAY_RANDOM, 1);
+        path.touch(MINID + 40);
+        pass = pass && path.getRoot()->getID() == MINID + 40;
+      }
+      pass = pass && path.verify();
+    }
+    return pass;
+  }
+  bool testMetering() {
+    bool pass = true;
+    WirelessPower wp(AVL);
+    wp.setMetering(true);
+    vector<int> ids;
+    for (int i = 0; i < 200; i++) {
+      int id = MINID + i * 7;
+      wp.insert(Customer(id, 0, 0));
+      ids.push_back(id);
+    }
+    pass = pass && !wp.addReading(MINID + 1, 0, 1); // not a customer
+    // every minute with some jitter, gaps and repeated values
+    map<int, vector<pair<long long, double>>> expected;
+    Random jitter(0, 5);
+    for (int id : ids) {
+      long long time = 1000 + id;
+      double watts = 100;
+      for (int i = 0; i < 700; i++) {
+        time += 60 + ((i % 50 == 0) ? 100000 : jitter.getRandNum());
+        if (i % 3 != 0) {
+          watts = (i % 7) * 12.5 - 20 + id % 3;
+        }
+        pass = pass && wp.addReading(id, time, watts);
+        expected[id].push_back(make_pair(time, watts));
+      }
+      pass = pass && !wp.addReading(id, time - 1, 0); // append only
+    }
+    for (int id : ids) { // decodes exactly
+      vector<long long> times;
+      vector<double> watts;
+      wp.m_meters[id - MINID]->read(LLONG_MIN, LLONG_MAX, times, watts);
+      pass = pass && times.size() == expected[id].size();
+      for (int i = 0; pass && i < (int)times.size(); i++) {
+        pass = times[i] == expected[id][i].first &&
+               watts[i] == expected[id][i].second;
+      }
+    }
+    auto brute = [&](int low, int high, long long from, long long to) {
+      MeterAggregate result;
+      for (int id : ids) {
+        for (auto &reading : expected[id]) {
+          if (id >= low && id <= high && reading.first >= from &&
+              reading.first < to) {
+            result.add(reading.second);
+          }
+        }
+      }
+      return result;
+    };
+    auto same = [](const MeterAggregate &a, const MeterAggregate &b) {
+      return a.m_count == b.m_count && a.m_max == b.m_max &&
+             fabs(a.m_sum - b.m_sum) < 1e-6 * (1 + fabs(b.m_sum));
+    };
+    long long from = 50000;
+    long long to = 400000;
+    pass = pass && same(wp.aggregate(ids[3], from, to),
+                        brute(ids[3], ids[3], from, to));
+    pass = pass && same(wp.aggregateRange(ids[10], ids[150], from, to, 4),
+                        brute(ids[10], ids[150], from, to));
+    vector<MeterAggregate> hours;
+    wp.rollup(0, 1000000, 3600, hours, 3);
+    pass = pass && hours.size() == 278;
+    for (int i = 0; i < (int)hours.size(); i++) {
+      pass = pass && same(hours[i], brute(MINID, MAXID, i * 3600LL,
+                                          (i + 1) * 3600LL));
+    }
+    wp.remove(ids[3]); // readings go with the customer
+    wp.removeRange(ids[10], ids[19]);
+    pass = pass && wp.aggregate(ids[3], LLONG_MIN, LLONG_MAX).m_count == 0 &&
+           wp.aggregateRange(ids[10], ids[19], LLONG_MIN, LLONG_MAX)
+                   .m_count == 0 &&
+           wp.aggregate(ids[20], LLONG_MIN, LLONG_MAX).m_count == 700;
+    return pass;
+  }
+  bool testApplyBatch() {
+    string path = "mytest.wal";
+    TREETYPE types[] = {BST, AVL, SPLAY, REDBLACK, SKIPLIST};
+    DELTATYPE kinds[] = {DELTA_INSERT, DELTA_REMOVE, DELTA_UPDATE};
+    Random fewIds(MINID, MINID + 999); // ops often hit the same id
+    Random kindGen(0, 2);
+    kindGen.setSeed(11); // the same seed as fewIds would tie kinds to ids
+    bool pass = true;
+    for (TREETYPE type : types) {
+      std::remove(path.c_str());
+      std::remove((path + ".snap").c_str());
+      WirelessPower sequential(type);
+      WirelessPower batched(type);
+      MutationLog log(path, 0);
+      batched.attachLog(&log);
+      for (WirelessPower *wp : {&sequential, &batched}) {
+        wp->setHashing(true);
+        wp->setTiling(3);
+        wp->setMetering(true);
+      }
+      int sizes[] = {0, 1, 50, 3000, 500}; // both sides of the thresholds
+      for (int size : sizes) {
+        vector<CustomerDelta> ops;
+        for (int i = 0; i < size; i++) {
+          CustomerDelta op = {kinds[kindGen.getRandNum()], fewIds.getRandNum(),
+                              (double)latGen.getRandNum(),
+                              (double)longGen.getRandNum()};
+          ops.push_back(op);
+          if (op.m_type == DELTA_INSERT) {
+            sequential.insert(Customer(op.m_id, op.m_latitude, op.m_longitude));
+          } else if (op.m_type == DELTA_REMOVE) {
+            sequential.remove(op.m_id);
+          } else if (type == SKIPLIST) { // no updateLocation, a move
+            if (sequential.touch(op.m_id)) {
+              sequential.remove(op.m_id);
+              sequential.insert(
+                  Customer(op.m_id, op.m_latitude, op.m_longitude));
+            }
+          } else {
+            sequential.updateLocation(op.m_id, op.m_latitude, op.m_longitude);
+          }
+        }
+        batched.applyBatch(ops);
+        pass = pass && batched == sequential && batched.verify() &&
+               batched.getTiles()->count(0, 0, 0) ==
+                   sequential.getTiles()->count(0, 0, 0);
+        for (int id = MINID; id < MINID + 1000; id += 97) {
+          sequential.addReading(id, size, 1);
+          batched.addReading(id, size, 1);
+        }
+      }
+      for (int id = MINID; id < MINID + 1000; id++) {
+        pass = pass && batched.aggregate(id, 0, 10000).m_count ==
+                           sequential.aggregate(id, 0, 10000).m_count;
+      }
+      batched.attachLog(nullptr);
+      WirelessPower replayed(AVL);
+      replayed.setHashing(true);
+      pass = pass && log.replay(replayed) > 0 &&
+             (type == SPLAY || replayed == batched);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".snap").c_str());
+    return pass;
+  }
+  bool testSmallRegistry() {
+    TREETYPE types[] = {BST, AVL, REDBLACK};
+    Random fewIds(MINID, MINID + 60); // about half of them are present
+    bool pass = true;
+    for (TREETYPE type : types) {
+      WirelessPower small(type);
+      WirelessPower tree(type);
+      small.setSmall(true);
+      for (WirelessPower *wp : {&small, &tree}) {
+        wp->setHashing(true); // == compares contents, not shapes
+        wp->setTiling(2);
+        wp->setMetering(true);
+      }
+      for (int i = 0; i < 2000; i++) {
+        int id = fewIds.getRandNum();
+        double lat = latGen.getRandNum();
+        double longitude = longGen.getRandNum();
+        if (i % 3 == 0 || small.countRange(MINID, MAXID) == SMALL_CUSTOMERS) {
+          small.remove(id);
+          tree.remove(id);
+        } else if (i % 5 == 0) {
+          pass = pass && small.updateLocation(id, lat, longitude) ==
+                             tree.updateLocation(id, lat, longitude);
+          pass = pass &&
+                 small.addReading(id, i, 1) == tree.addReading(id, i, 1);
+        } else {
+          small.insert(Customer(id, lat, longitude));
+          tree.insert(Customer(id, lat, longitude));
+        }
+        pass = pass && small.verify() && small == tree &&
+               small.touch(id) == tree.touch(id) &&
+               small.rank(id) == tree.rank(id) &&
+               small.select(i % 40) == tree.select(i % 40) &&
+               small.countRange(id, id + 10) == tree.countRange(id, id + 10) &&
+               small.countRange(id, INT_MAX) == tree.countRange(id, INT_MAX) &&
+               small.getTiles()->count(0, 0, 0) ==
+                   tree.getTiles()->count(0, 0, 0);
+      }
+      vector<CustomerDelta> delta;
+      small.diff(tree, delta);
+      pass = pass && small.m_small != nullptr && delta.empty() &&
+             small.aggregateRange(MINID, MAXID, 0, 2000).m_count ==
+                 tree.aggregateRange(MINID, MAXID, 0, 2000).m_count;
+
+      // grows past the array and stays a tree
+      for (int id = MINID + 100; id < MINID + 140; id++) {
+        small.insert(Customer(id, 0, 0));
+        tree.insert(Customer(id, 0, 0));
+      }
+      small.removeRange(MINID + 100, MINID + 139);
+      tree.removeRange(MINID + 100, MINID + 139);
+      pass = pass && small.m_small == nullptr && small.verify() &&
+             small == tree && small.getType() == type;
+    }
+    // setType keeps the array, a SKIPLIST turns it into the list
+    WirelessPower wp(SPLAY);
+    wp.setSmall(true);
+    wp.insert(Customer(MINID, 0, 0));
+    wp.setType(AVL);
+    pass = pass && wp.m_small != nullptr && wp.find(MINID);
+    wp.setType(SKIPLIST);
+    pass = pass && wp.m_small == nullptr && wp.find(MINID) && wp.verify();
+    return pass;
+  }
+  bool testSharedRegistry() {
+    string name = "/wpower_mytest";
+    bool pass = true;
+    {
+      SharedRegistry writer(name, 3000);
+      WirelessPower expected(AVL);
+      Random fewIds(MINID, MINID + 4000);
+      for (int i = 0; i < 6000; i++) {
+        int id = fewIds.getRandNum();
+        if (i % 3 == 0) {
+          pass = pass && writer.remove(id) == expected.find(id);
+          expected.remove(id);
+        } else {
+          Customer customer(id, latGen.getRandNum(), longGen.getRandNum());
+          writer.insert(customer);
+          expected.insert(customer);
+        }
+      }
+      pass = pass && writer.isOpen() && writer.verify() &&
+             writer.size() == expected.countRange(MINID, MAXID);
+      SharedRegistry reader(name);
+      Customer found(0, 0, 0);
+      for (int id = MINID; id <= MINID + 4000; id++) {
+        const Customer *customer = expected.findNode(id);
+        bool present = reader.find(id, found);
+        pass = pass && present == (customer != nullptr) &&
+               (!present || (found.getLatitude() == customer->getLatitude() &&
+                             found.getLongitude() == customer->getLongitude()));
+      }
+      pass = pass && !reader.insert(Customer(MINID, 0, 0)); // read-only
+
+      // a full segment only takes ids it already holds
+      SharedRegistry full(name + "_full", 2);
+      pass = pass && full.insert(Customer(MINID, 0, 0)) &&
+             full.insert(Customer(MINID + 1, 0, 0)) &&
+             !full.insert(Customer(MINID + 2, 0, 0)) &&
+             full.insert(Customer(MINID, 1, 1)) && full.remove(MINID) &&
+             full.insert(Customer(MINID + 2, 0, 0)) && full.verify();
+      SharedRegistry::unlink(name + "_full");
+      pass = pass && !SharedRegistry(name + "_full").isOpen();
+
+      // a reader process never misses the ids that stay while one writer
+      // churns the rest of the tree
+      pass = pass && writer.load(expected) && writer.verify();
+      int stay = MINID + 4001;
+      for (int id = stay; id < stay + 200; id++) {
+        writer.insert(Customer(id, id, 0));
+      }
+      pid_t child = fork();
+      if (child == 0) {
+        SharedRegistry process(name);
+        bool good = process.isOpen();
+        for (int round = 0; round < 200; round++) {
+          for (int id = stay; id < stay + 200; id++) {
+            good = good && process.find(id, found) && found.getLatitude() == id;
+          }
+        }
+        _exit(good ? 0 : 1);
+      }
+      for (int i = 0; i < 20000; i++) {
+        int id = fewIds.getRandNum();
+        if (i % 2 == 0) {
+          writer.remove(id);
+        } else {
+          writer.insert(Customer(id, 0, 0));
+        }
+      }
+      int status = 1;
+      waitpid(child, &status, 0);
+      pass = pass && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+             writer.verify();
+    }
+    SharedRegistry::unlink(name);
+    return pass;
+  }
+  bool testLatencyStats() {
+    // bucket error stays below 1/16
+    LatencyStats stats(1000000);
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    for (int nanos = 1; nanos <= 100000; nanos++) {
+      stats.record(OP_INSERT, AVL, MINID, now, nanos, 0, 0);
+    }
+    bool pass = stats.count(OP_INSERT, AVL) == 100000 &&
+                stats.max(OP_INSERT, AVL) == 100000 &&
+                stats.slowOps().empty();
+    double percents[] = {1, 50, 90, 99, 99.9, 100};
+    for (double percent : percents) {
+      double exact = percent * 1000;
+      double found = stats.percentile(OP_INSERT, AVL, percent);
+      pass = pass && found >= exact && found <= exact * 17 / 16;
+    }
+
+    // every call is slow with a 0ns threshold
+    WirelessPower wp(AVL);
+    wp.setProfiling(true, 0);
+    for (int i = 0; i < 500; i++) {
+      Customer customer(idGen.getRandNum(), latGen.getRandNum(),
+                        longGen.getRandNum());
+      wp.insert(customer);
+    }
+    for (int i = 0; i < 100; i++) {
+      wp.remove(idGen.getRandNum());
+    }
+    for (int i = 0; i < 20; i++) {
+      wp.insertHinted(Customer(MAXID - i, 0, 0));
+    }
+    wp.setType(SPLAY);
+    for (int i = 0; i < 50; i++) {
+      wp.touch(idGen.getRandNum());
+    }
+    const LatencyStats *profile = wp.getStats();
+    pass = pass && profile->count(OP_INSERT, AVL) == 500 &&
+           profile->count(OP_INSERT_HINTED, AVL) == 20 &&
+           profile->count(OP_REMOVE, AVL) == 100 &&
+           profile->count(OP_SETTYPE, AVL) == 1 &&
+           profile->count(OP_LOOKUP, SPLAY) == 50 &&
+           profile->percentile(OP_INSERT, AVL, 50) <=
+               profile->percentile(OP_INSERT, AVL, 99);
+    vector<SlowOp> slow = profile->slowOps();
+    int rotations = 0;
+    for (int i = 0; i < (int)slow.size(); i++) {
+      rotations += slow[i].m_rotations;
+      pass = pass && (slow[i].m_op != OP_INSERT || slow[i].m_path > 0) &&
+             (i == 0 || slow[i].m_startNanos >= slow[i - 1].m_startNanos);
+    }
+    string json = profile->toJSON();
+    string trace = profile->toChromeTrace();
+    pass = pass && slow.size() == 671 && rotations > 0 &&
+           json.find("\"op\":\"setType\"") != string::npos &&
+           trace.find("{\"traceEvents\":[{\"name\":\"insert\"") == 0;
+    wp.setProfiling(false);
+    return pass && wp.getStats() == nullptr;
+  }
 };
 
 int main() {
@@ -353,5 +1465,120 @@ int main() {
   } else {
     cout << "Failed AssignmentError" << endl;
   }
+  if (t.testRedBlackInsert()) {
+    cout << "Passed RedBlackInsert" << endl;
+  } else {
+    cout << "Failed RedBlackInsert" << endl;
+  }
+  if (t.testRedBlackRemove()) {
+    cout << "Passed RedBlackRemove" << endl;
+  } else {
+    cout << "Failed RedBlackRemove" << endl;
+  }
+  if (t.testSetTypeRedBlack()) {
+    cout << "Passed SetTypeRedBlack" << endl;
+  } else {
+    cout << "Failed SetTypeRedBlack" << endl;
+  }
+  if (t.testIncrementalSetType()) {
+    cout << "Passed IncrementalSetType" << endl;
+  } else {
+    cout << "Failed IncrementalSetType" << endl;
+  }
+  if (t.testBoundedConversion()) {
+    cout << "Passed BoundedConversion" << endl;
+  } else {
+    cout << "Failed BoundedConversion" << endl;
+  }
+  if (t.testMutationLogReplay()) {
+    cout << "Passed MutationLogReplay" << endl;
+  } else {
+    cout << "Failed MutationLogReplay" << endl;
+  }
+  if (t.testMerkleDiff()) {
+    cout << "Passed MerkleDiff" << endl;
+  } else {
+    cout << "Failed MerkleDiff" << endl;
+  }
+  if (t.testVerify()) {
+    cout << "Passed Verify" << endl;
+  } else {
+    cout << "Failed Verify" << endl;
+  }
+  if (t.testCombiningWriters()) {
+    cout << "Passed CombiningWriters" << endl;
+  } else {
+    cout << "Failed CombiningWriters" << endl;
+  }
+  if (t.testTileCounts()) {
+    cout << "Passed TileCounts" << endl;
+  } else {
+    cout << "Failed TileCounts" << endl;
+  }
+  if (t.testRemoveRangeBatch()) {
+    cout << "Passed RemoveRangeBatch" << endl;
+  } else {
+    cout << "Failed RemoveRangeBatch" << endl;
+  }
+  if (t.testOrderStatistics()) {
+    cout << "Passed OrderStatistics" << endl;
+  } else {
+    cout << "Failed OrderStatistics" << endl;
+  }
+  if (t.testSplayCapacity()) {
+    cout << "Passed SplayCapacity" << endl;
+  } else {
+    cout << "Failed SplayCapacity" << endl;
+  }
+  if (t.testTraceReplay()) {
+    cout << "Passed TraceReplay" << endl;
+  } else {
+    cout << "Failed TraceReplay" << endl;
+  }
+  if (t.testHintedInsert()) {
+    cout << "Passed HintedInsert" << endl;
+  } else {
+    cout << "Failed HintedInsert" << endl;
+  }
+  if (t.testCompact()) {
+    cout << "Passed Compact" << endl;
+  } else {
+    cout << "Failed Compact" << endl;
+  }
+  if (t.testLatencyStats()) {
+    cout << "Passed LatencyStats" << endl;
+  } else {
+    cout << "Failed LatencyStats" << endl;
+  }
+  if (t.testSkipList()) {
+    cout << "Passed SkipList" << endl;
+  } else {
+    cout << "Failed SkipList" << endl;
+  }
+  if (t.testSplayPolicies()) {
+    cout << "Passed SplayPolicies" << endl;
+  } else {
+    cout << "Failed SplayPolicies" << endl;
+  }
+  if (t.testMetering()) {
+    cout << "Passed Metering" << endl;
+  } else {
+    cout << "Failed Metering" << endl;
+  }
+  if (t.testApplyBatch()) {
+    cout << "Passed ApplyBatch" << endl;
+  } else {
+    cout << "Failed ApplyBatch" << endl;
+  }
+  if (t.testSmallRegistry()) {
+    cout << "Passed SmallRegistry" << endl;
+  } else {
+    cout << "Failed SmallRegistry" << endl;
+  }
+  if (t.testSharedRegistry()) {
+    cout << "Passed SharedRegistry" << endl;
+  } else {
+    cout << "Failed SharedRegistry" << endl;
+  }
   return 0;
 }
@@ -0,0 +1,109 @@
+#include "wpcombine.h"
+#include <algorithm>
+#include <functional>
+
+CombiningWirelessPower::CombiningWirelessPower(WirelessPower &wp, int slots)
+    : m_wp(wp), m_slots(max(slots, 1)), m_pending(0), m_batches(0),
+      m_stop(false) {
+  m_combiner = thread(&CombiningWirelessPower::combinerLoop, this);
+}
+
+CombiningWirelessPower::~CombiningWirelessPower() {
+  {
+    lock_guard<mutex> lock(m_wakeMutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_combiner.join();
+}
+
+future<bool> CombiningWirelessPower::insertAsync(const Customer &customer) {
+  return publish(new Operation(COMBINE_INSERT, customer));
+}
+
+future<bool> CombiningWirelessPower::removeAsync(int id) {
+  return publish(new Operation(COMBINE_REMOVE, Customer(id, 0, 0)));
+}
+
+bool CombiningWirelessPower::insert(const Customer &customer) {
+  return insertAsync(customer).get();
+}
+
+bool CombiningWirelessPower::remove(int id) { return removeAsync(id).get(); }
+
+long long CombiningWirelessPower::batches() const { return m_batches; }
+
+future<bool> CombiningWirelessPower::publish(Operation *operation) {
+  future<bool> result = operation->m_result.get_future();
+  // threads hash to a slot, two threads sharing one only contend on its lock
+  size_t index = hash<thread::id>()(this_thread::get_id()) % m_slots.size();
+  Slot &slot = m_slots[index];
+  {
+    lock_guard<mutex> lock(slot.m_mutex);
+    slot.m_operations.push_back(operation);
+  }
+  if (m_pending.fetch_add(1) == 0) { // the combiner may be asleep
+    lock_guard<mutex> lock(m_wakeMutex);
+    m_wake.notify_one();
+  }
+  return result;
+}
+
+void CombiningWirelessPower::combinerLoop() {
+  vector<Operation *> batch;
+  while (true) {
+    {
+      unique_lock<mutex> lock(m_wakeMutex);
+      m_wake.wait(lock, [this]() { return m_stop || m_pending > 0; });
+      if (m_stop && m_pending == 0) {
+        return;
+      }
+    }
+    for (Slot &slot : m_slots) {
+      lock_guard<mutex> lock(slot.m_mutex);
+      batch.insert(batch.end(), slot.m_operations.begin(),
+                   slot.m_operations.end());
+      slot.m_operations.clear();
+    }
+    m_pending -= (int)batch.size();
+    applyBatch(batch);
+    batch.clear();
+  }
+}
+
+void CombiningWirelessPower::applyBatch(vector<Operation *> &batch) {
+  // stable keeps the publish order of operations on the same id
+  stable_sort(batch.begin(), batch.end(),
+              [](const Operation *lhs, const Operation *rhs) {
+                return lhs->m_customer.getID() < rhs->m_customer.getID();
+              });
+  // one lookup per id tells what each operation on it will change, then the
+  // whole batch is merged into the tree at once
+  bool removes = m_wp.getType() != SPLAY; // splay trees never remove
+  vector<CustomerDelta> ops;
+  vector<bool> changed;
+  bool present = false;
+  for (int i = 0; i < (int)batch.size(); i++) {
+    const Customer &customer = batch[i]->m_customer;
+    if (i == 0 || customer.getID() != batch[i - 1]->m_customer.getID()) {
+      present = m_wp.find(customer.getID());
+    }
+    if (batch[i]->m_type == COMBINE_INSERT) {
+      ops.push_back(CustomerDelta{DELTA_INSERT, customer.getID(),
+                                  customer.getLatitude(),
+                                  customer.getLongitude()});
+      changed.push_back(!present);
+      present = true;
+    } else {
+      ops.push_back(CustomerDelta{DELTA_REMOVE, customer.getID(), 0, 0});
+      changed.push_back(present && removes);
+      present = present && !removes;
+    }
+  }
+  m_wp.applyBatch(ops);
+  for (int i = 0; i < (int)batch.size(); i++) {
+    batch[i]->m_result.set_value(changed[i]);
+    delete batch[i];
+  }
+  m_batches++;
+}
@@ -0,0 +1,64 @@
+#ifndef WPCOMBINE_H
+#define WPCOMBINE_H
+#include "wpower.h"
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// Flat-combining front end for one WirelessPower shared by many threads.
+// Callers publish operations into per-thread slots instead of fighting over
+// a lock around the tree. One combiner thread takes every published
+// operation at once, sorts the batch by id so consecutive descents share
+// most of their path, applies it and fulfills each caller's future.
+//
+// The futures hold true when the operation changed the registry: the id was
+// new for an insert or present for a remove.
+//
+// Slots are picked by hashing the thread id, so with more threads than
+// slots, or an unlucky hash, two threads share a slot. That is still
+// correct, since every slot is guarded by its own mutex, they only contend
+// on it.
+
+enum COMBINEOP { COMBINE_INSERT, COMBINE_REMOVE };
+
+class CombiningWirelessPower {
+public:
+  CombiningWirelessPower(WirelessPower &wp, int slots = 64);
+  ~CombiningWirelessPower(); // applies anything still published
+
+  future<bool> insertAsync(const Customer &customer);
+  future<bool> removeAsync(int id);
+  bool insert(const Customer &customer); // blocks until applied
+  bool remove(int id);
+  long long batches() const; // batches applied so far
+
+private:
+  struct Operation {
+    Operation(COMBINEOP type, const Customer &customer)
+        : m_type(type), m_customer(customer) {}
+    COMBINEOP m_type;
+    Customer m_customer;
+    promise<bool> m_result;
+  };
+  struct Slot {
+    mutex m_mutex;
+    vector<Operation *> m_operations;
+  };
+
+  WirelessPower &m_wp; // only ever touched by the combiner thread
+  vector<Slot> m_slots;
+  atomic<int> m_pending; // published but not yet taken by the combiner
+  atomic<long long> m_batches;
+  mutex m_wakeMutex;
+  condition_variable m_wake;
+  bool m_stop;
+  thread m_combiner;
+
+  future<bool> publish(Operation *operation);
+  void combinerLoop();
+  void applyBatch(vector<Operation *> &batch);
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "wplog.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INSERT_RECORD_SIZE 25
+#define REMOVE_RECORD_SIZE 9
+#define MAX_BUFFER_BYTES (1 << 20) // commit early once this much is buffered
+
+static uint32_t crc32(const char *data, size_t length) {
+  // built once, thread safe as a function-local static
+  static const array<uint32_t, 256> table = [] {
+    array<uint32_t, 256> entries;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; bit++) {
+        value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+      }
+      entries[i] = value;
+    }
+    return entries;
+  }();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+static void putBytes(string &record, const void *value, size_t size) {
+  record.append((const char *)value, size);
+}
+
+static void sealRecord(string &record, size_t start) {
+  uint32_t crc = crc32(record.data() + start, record.size() - start);
+  putBytes(record, &crc, sizeof(crc));
+}
+
+static void encodeInsert(string &records, int id, double lat,
+                         double longitude) {
+  size_t start = records.size();
+  char type = LOG_INSERT;
+  int32_t id32 = id;
+  putBytes(records, &type, sizeof(type));
+  putBytes(records, &id32, sizeof(id32));
+  putBytes(records, &lat, sizeof(lat));
+  putBytes(records, &longitude, sizeof(longitude));
+  sealRecord(records, start);
+}
+
+// per id result of folding every record, applied once at the end of replay
+struct LogFold {
+  bool sawRemove; // a remove must be applied before the insert
+  bool present;
+  double latitude;
+  double longitude;
+};
+
+MutationLog::MutationLog(const string &path, int commitMicros)
+    : m_path(path), m_fd(-1), m_commitMicros(commitMicros), m_failed(false),
+      m_stop(false) {
+  string records;
+  long validLength = readRecords(path, records);
+  m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (m_fd >= 0 && validLength >= 0) {
+    struct stat info;
+    if (fstat(m_fd, &info) == 0 && info.st_size > validLength) {
+      if (ftruncate(m_fd, validLength) != 0) { // cut off a torn tail
+        close(m_fd);
+        m_fd = -1;
+      }
+    }
+  }
+  if (m_fd >= 0 && m_commitMicros > 0) {
+    m_flusher = std::thread(&MutationLog::flusherLoop, this);
+  }
+}
+
+MutationLog::~MutationLog() {
+  {
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  if (m_flusher.joinable()) {
+    m_flusher.join();
+  }
+  commit();
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+bool MutationLog::isOpen() const { return m_fd >= 0; }
+
+bool MutationLog::hasFailed() const { return m_failed; }
+
+bool MutationLog::logInsert(const Customer &customer) {
+  string record;
+  encodeInsert(record, customer.getID(), customer.getLatitude(),
+               customer.getLongitude());
+  return append(record);
+}
+
+bool MutationLog::logRemove(int id) {
+  string record;
+  char type = LOG_REMOVE;
+  int32_t id32 = id;
+  putBytes(record, &type, sizeof(type));
+  putBytes(record, &id32, sizeof(id32));
+  sealRecord(record, 0);
+  return append(record);
+}
+
+bool MutationLog::append(const string &record) {
+  if (m_fd < 0) {
+    return false;
+  }
+  bool full = false;
+  {
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    if (m_failed) {
+      return false;
+    }
+    if (m_buffer.empty()) {
+      m_oldest = std::chrono::steady_clock::now();
+      m_wake.notify_one(); // start the commit timer
+    }
+    m_buffer += record;
+    full = m_buffer.size() >= MAX_BUFFER_BYTES;
+  }
+  if (m_commitMicros == 0 || full) {
+    return commit();
+  }
+  return true;
+}
+
+bool MutationLog::commit() {
+  std::lock_guard<std::mutex> fileLock(m_fileMutex);
+  string pending;
+  {
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    pending.swap(m_buffer);
+  }
+  if (m_failed || m_fd < 0) {
+    return false; // whatever was still buffered is dropped
+  }
+  if (!pending.empty() &&
+      (!writeAll(m_fd, pending) || fdatasync(m_fd) != 0)) {
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    m_failed = true;
+    m_buffer.clear();
+    return false;
+  }
+  return true;
+}
+
+void MutationLog::flusherLoop() {
+  std::unique_lock<std::mutex> lock(m_bufferMutex);
+  while (!m_stop) {
+    if (m_buffer.empty()) {
+      m_wake.wait(lock);
+      continue;
+    }
+    std::chrono::steady_clock::time_point deadline =
+        m_oldest + std::chrono::microseconds(m_commitMicros);
+    if (std::chrono::steady_clock::now() < deadline) {
+      m_wake.wait_until(lock, deadline);
+      continue; // woken early or the buffer was committed meanwhile
+    }
+    lock.unlock();
+    commit();
+    lock.lock();
+  }
+}
+
+bool MutationLog::writeAll(int fd, const string &data) const {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = write(fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+long MutationLog::readRecords(const string &path, string &records) const {
+  ifstream file(path.c_str(), ios::binary);
+  if (!file) {
+    return 0; // nothing logged yet
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  string data = contents.str();
+
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t size = 0;
+    if (data[offset] == LOG_INSERT) {
+      size = INSERT_RECORD_SIZE;
+    } else if (data[offset] == LOG_REMOVE) {
+      size = REMOVE_RECORD_SIZE;
+    }
+    if (size == 0 || offset + size > data.size()) {
+      break; // unknown type or torn record
+    }
+    uint32_t crc = 0;
+    memcpy(&crc, data.data() + offset + size - sizeof(crc), sizeof(crc));
+    if (crc != crc32(data.data() + offset, size - sizeof(crc))) {
+      break;
+    }
+    offset += size;
+  }
+  records.append(data, 0, offset);
+  return (long)offset;
+}
+
+int MutationLog::replay(WirelessPower &wp) {
+  commit();
+  string records;
+  if (readRecords(m_path + ".snap", records) < 0 ||
+      readRecords(m_path, records) < 0) {
+    return -1;
+  }
+
+  // fold every record per id so each id touches the tree at most twice
+  vector<LogFold> folds(MAXID - MINID + 1, LogFold{false, false, 0, 0});
+  int count = 0;
+  size_t offset = 0;
+  while (offset < records.size()) {
+    char type = records[offset];
+    int32_t id = 0;
+    memcpy(&id, records.data() + offset + 1, sizeof(id));
+    bool inRange = id >= MINID && id <= MAXID;
+    if (type == LOG_INSERT) {
+      if (inRange && !folds[id - MINID].present) { // duplicates are ignored
+        LogFold &fold = folds[id - MINID];
+        fold.present = true;
+        memcpy(&fold.latitude, records.data() + offset + 5, sizeof(double));
+        memcpy(&fold.longitude, records.data() + offset + 13, sizeof(double));
+      }
+      offset += INSERT_RECORD_SIZE;
+    } else {
+      if (inRange) {
+        folds[id - MINID].sawRemove = true;
+        folds[id - MINID].present = false;
+      }
+      offset += REMOVE_RECORD_SIZE;
+    }
+    count++;
+  }
+
+  MutationLog *attached = wp.m_log; // replayed records are already logged
+  wp.m_log = nullptr;
+  if (wp.isEmpty()) {
+    // ids come out sorted, so the tree is built balanced in one go
+    vector<Customer *> nodes;
+    for (int i = 0; i < (int)folds.size(); i++) {
+      if (folds[i].present) {
+        nodes.push_back(
+            new Customer(MINID + i, folds[i].latitude, folds[i].longitude));
+      }
+    }
+    wp.adopt(nodes);
+  } else {
+    // the folds become one change set, merged into the tree in one pass
+    vector<CustomerDelta> ops;
+    for (int i = 0; i < (int)folds.size(); i++) {
+      if (folds[i].sawRemove) {
+        ops.push_back(CustomerDelta{DELTA_REMOVE, MINID + i, 0, 0});
+      }
+      if (folds[i].present) {
+        ops.push_back(CustomerDelta{DELTA_INSERT, MINID + i,
+                                    folds[i].latitude, folds[i].longitude});
+      }
+    }
+    wp.applyBatch(std::move(ops));
+  }
+  wp.m_log = attached;
+  return count;
+}
+
+void MutationLog::encodeTree(const Customer *customer, string &records) const {
+  if (customer != nullptr) {
+    encodeTree(customer->getLeft(), records);
+    encodeInsert(records, customer->getID(), customer->getLatitude(),
+                 customer->getLongitude());
+    encodeTree(customer->getRight(), records);
+  }
+}
+
+bool MutationLog::compact(const WirelessPower &wp) {
+  commit();
+  std::lock_guard<std::mutex> fileLock(m_fileMutex);
+  if (m_fd < 0) {
+    return false;
+  }
+  string records;
+  vector<Customer *> nodes;
+  wp.contents(nodes);
+  for (Customer *customer : nodes) {
+    encodeTree(customer, records);
+    delete customer;
+  }
+
+  // write the new snapshot aside and rename it over the old one
+  string snapPath = m_path + ".snap";
+  string tempPath = snapPath + ".tmp";
+  int snapFd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (snapFd < 0) {
+    return false;
+  }
+  bool pass = writeAll(snapFd, records) && fsync(snapFd) == 0;
+  close(snapFd);
+  pass = pass && rename(tempPath.c_str(), snapPath.c_str()) == 0;
+  if (!pass) {
+    unlink(tempPath.c_str());
+    return false;
+  }
+  // everything in the log is now in the snapshot
+  if (ftruncate(m_fd, 0) != 0 || fdatasync(m_fd) != 0) {
+    m_failed = true; // the log may still hold records the snapshot has
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,78 @@
+#ifndef WPLOG_H
+#define WPLOG_H
+#include "wpower.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Append-only write-ahead log of WirelessPower mutations. Every insert and
+// remove of an attached WirelessPower is encoded as one binary record with
+// a CRC32 and buffered. A flusher thread writes and fsyncs the buffer once
+// the oldest unsynced record is commitMicros old, so many mutations share
+// one fsync (group commit). commitMicros == 0 syncs every record before the
+// mutation returns.
+//
+// Record layout, fields in host byte order:
+//   INSERT: type(1) id(4) latitude(8) longitude(8) crc(4)
+//   REMOVE: type(1) id(4) crc(4)
+// The crc covers every byte of the record before it. A torn or corrupted
+// tail is cut off when the log is opened.
+//
+// compact() writes the current tree as INSERT records to <path>.snap and
+// empties the log, replay() loads the snapshot followed by the log.
+//
+// A failed write or sync latches the log into a failed state: the records
+// buffered at that point are dropped and every later append is refused, so
+// the file never holds a record after a gap.
+
+enum LOGRECORD { LOG_INSERT = 1, LOG_REMOVE = 2 };
+
+class MutationLog {
+public:
+  friend class Tester;
+
+  MutationLog(const string &path, int commitMicros = 1000);
+  ~MutationLog(); // syncs anything still buffered
+  bool isOpen() const;
+  bool hasFailed() const; // a write or sync failed, nothing is logged since
+
+  // return false if the record was refused because the log is closed or
+  // failed, or if committing it right away failed
+  bool logInsert(const Customer &customer);
+  bool logRemove(int id);
+  // writes and fsyncs everything logged so far, false once the log failed
+  bool commit();
+
+  // folds the snapshot and the log per id and applies the result to wp in
+  // one pass, returns the number of records read or -1 on error
+  int replay(WirelessPower &wp);
+  // replaces the snapshot with the contents of wp and empties the log
+  bool compact(const WirelessPower &wp);
+
+private:
+  string m_path;
+  int m_fd;
+  int m_commitMicros;
+  // records waiting for the next group commit
+  string m_buffer;
+  std::chrono::steady_clock::time_point m_oldest;
+  std::mutex m_bufferMutex; // guards m_buffer and m_oldest
+  std::mutex m_fileMutex;   // serializes writes and fsyncs of m_fd
+  std::atomic<bool> m_failed;
+  std::condition_variable m_wake;
+  bool m_stop;
+  std::thread m_flusher;
+
+  bool append(const string &record);
+  void flusherLoop();
+  bool writeAll(int fd, const string &data) const;
+  // reads every valid record from a file, returns the valid length in bytes
+  // or -1 if the file cannot be read
+  long readRecords(const string &path, string &records) const;
+  void encodeTree(const Customer *customer, string &records) const;
+};
+
+#endif
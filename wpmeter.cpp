@@ -0,0 +1,255 @@
+#include "wpmeter.h"
+#include <algorithm>
+#include <cstring>
+
+// appends the low count bits of value to column, most significant first
+static void putBits(vector<uint64_t> &column, int &used, uint64_t value,
+                    int count) {
+  if (count < 64) {
+    value &= (1ULL << count) - 1;
+  }
+  int offset = used % 64;
+  if (offset == 0) {
+    column.push_back(0);
+  }
+  int room = 64 - offset;
+  if (count <= room) {
+    column.back() |= value << (room - count);
+  } else { // split over two words
+    column.back() |= value >> (count - room);
+    column.push_back(value << (64 - (count - room)));
+  }
+  used += count;
+}
+
+class BitReader {
+public:
+  BitReader(const vector<uint64_t> &column) : m_column(column), m_used(0) {}
+  uint64_t read(int count) {
+    int index = m_used / 64;
+    int offset = m_used % 64;
+    int room = 64 - offset;
+    m_used += count;
+    if (count <= room) {
+      return (m_column[index] << offset) >> (64 - count);
+    }
+    int rest = count - room;
+    uint64_t high = m_column[index] & ((1ULL << room) - 1);
+    return (high << rest) | (m_column[index + 1] >> (64 - rest));
+  }
+  long long readSigned(int count) {
+    return (long long)(read(count) << (64 - count)) >> (64 - count);
+  }
+
+private:
+  const vector<uint64_t> &m_column;
+  int m_used;
+};
+
+// blocks never span two windows, so windowed rollups use the summaries
+static long long window(long long time) {
+  return (time >= 0) ? time / METER_WINDOW
+                     : (time - METER_WINDOW + 1) / METER_WINDOW;
+}
+
+MeterSeries::MeterSeries()
+    : m_timeBits(0), m_valueBits(0), m_delta(0), m_previous(0),
+      m_leading(-1), m_trailing(0) {}
+
+bool MeterSeries::append(long long time, double watts) {
+  if (!m_blocks.empty() && time < m_blocks.back().m_last) {
+    return false;
+  }
+  uint64_t bits = 0;
+  memcpy(&bits, &watts, sizeof(bits));
+  if (m_blocks.empty() || m_blocks.back().m_summary.m_count == METER_BLOCK ||
+      window(time) != window(m_blocks.back().m_first)) {
+    m_blocks.push_back(Block());
+    m_blocks.back().m_first = time;
+    m_timeBits = 0;
+    m_valueBits = 0;
+    m_delta = 0;
+    m_leading = -1;
+    m_trailing = 0;
+  }
+  Block &block = m_blocks.back();
+  if (block.m_summary.m_count == 0) {
+    putBits(block.m_times, m_timeBits, (uint64_t)time, 64);
+    putBits(block.m_values, m_valueBits, bits, 64);
+  } else {
+    long long delta = time - block.m_last;
+    long long deltaOfDelta = delta - m_delta;
+    m_delta = delta;
+    if (deltaOfDelta == 0) {
+      putBits(block.m_times, m_timeBits, 0, 1);
+    } else if (deltaOfDelta >= -64 && deltaOfDelta < 64) {
+      putBits(block.m_times, m_timeBits, 2, 2);
+      putBits(block.m_times, m_timeBits, deltaOfDelta, 7);
+    } else if (deltaOfDelta >= -256 && deltaOfDelta < 256) {
+      putBits(block.m_times, m_timeBits, 6, 3);
+      putBits(block.m_times, m_timeBits, deltaOfDelta, 9);
+    } else if (deltaOfDelta >= -2048 && deltaOfDelta < 2048) {
+      putBits(block.m_times, m_timeBits, 14, 4);
+      putBits(block.m_times, m_timeBits, deltaOfDelta, 12);
+    } else {
+      putBits(block.m_times, m_timeBits, 15, 4);
+      putBits(block.m_times, m_timeBits, deltaOfDelta, 64);
+    }
+
+    uint64_t difference = bits ^ m_previous;
+    if (difference == 0) {
+      putBits(block.m_values, m_valueBits, 0, 1);
+    } else {
+      int leading = min(31, __builtin_clzll(difference));
+      int trailing = __builtin_ctzll(difference);
+      if (m_leading >= 0 && leading >= m_leading && trailing >= m_trailing) {
+        putBits(block.m_values, m_valueBits, 2, 2); // reuse the window
+        putBits(block.m_values, m_valueBits, difference >> m_trailing,
+                64 - m_leading - m_trailing);
+      } else {
+        int length = 64 - leading - trailing;
+        putBits(block.m_values, m_valueBits, 3, 2);
+        putBits(block.m_values, m_valueBits, leading, 5);
+        putBits(block.m_values, m_valueBits, length - 1, 6);
+        putBits(block.m_values, m_valueBits, difference >> trailing, length);
+        m_leading = leading;
+        m_trailing = trailing;
+      }
+    }
+  }
+  m_previous = bits;
+  block.m_last = time;
+  block.m_summary.add(watts);
+  return true;
+}
+
+int MeterSeries::size() const {
+  int count = 0;
+  for (const Block &block : m_blocks) {
+    count += block.m_summary.m_count;
+  }
+  return count;
+}
+
+size_t MeterSeries::bytes() const {
+  size_t total = 0;
+  for (const Block &block : m_blocks) {
+    total += (block.m_times.size() + block.m_values.size()) * sizeof(uint64_t);
+  }
+  return total;
+}
+
+void MeterSeries::decode(const Block &block, vector<long long> &times,
+                         vector<double> &watts) const {
+  BitReader timeColumn(block.m_times);
+  BitReader valueColumn(block.m_values);
+  long long time = (long long)timeColumn.read(64);
+  uint64_t bits = valueColumn.read(64);
+  long long delta = 0;
+  int leading = 0;
+  int trailing = 0;
+  for (int i = 0; i < block.m_summary.m_count; i++) {
+    if (i > 0) {
+      long long deltaOfDelta = 0;
+      if (timeColumn.read(1) == 0) {
+        deltaOfDelta = 0;
+      } else if (timeColumn.read(1) == 0) {
+        deltaOfDelta = timeColumn.readSigned(7);
+      } else if (timeColumn.read(1) == 0) {
+        deltaOfDelta = timeColumn.readSigned(9);
+      } else if (timeColumn.read(1) == 0) {
+        deltaOfDelta = timeColumn.readSigned(12);
+      } else {
+        deltaOfDelta = (long long)timeColumn.read(64);
+      }
+      delta += deltaOfDelta;
+      time += delta;
+
+      if (valueColumn.read(1) == 1) {
+        if (valueColumn.read(1) == 1) { // a new window
+          leading = (int)valueColumn.read(5);
+          trailing = 64 - leading - ((int)valueColumn.read(6) + 1);
+        }
+        bits ^= valueColumn.read(64 - leading - trailing) << trailing;
+      }
+    }
+    double value = 0;
+    memcpy(&value, &bits, sizeof(value));
+    times.push_back(time);
+    watts.push_back(value);
+  }
+}
+
+MeterAggregate MeterSeries::aggregate(long long from, long long to) const {
+  MeterAggregate result;
+  // the first block that can hold a reading at or after from
+  auto block = lower_bound(
+      m_blocks.begin(), m_blocks.end(), from,
+      [](const Block &candidate, long long time) {
+        return candidate.m_last < time;
+      });
+  vector<long long> times;
+  vector<double> watts;
+  for (; block != m_blocks.end() && block->m_first < to; ++block) {
+    if (block->m_first >= from && block->m_last < to) {
+      result.merge(block->m_summary);
+      continue;
+    }
+    times.clear();
+    watts.clear();
+    decode(*block, times, watts);
+    for (int i = 0; i < (int)times.size(); i++) {
+      if (times[i] >= from && times[i] < to) {
+        result.add(watts[i]);
+      }
+    }
+  }
+  return result;
+}
+
+void MeterSeries::rollup(long long from, long long to, long long width,
+                         vector<MeterAggregate> &buckets) const {
+  auto block = lower_bound(
+      m_blocks.begin(), m_blocks.end(), from,
+      [](const Block &candidate, long long time) {
+        return candidate.m_last < time;
+      });
+  vector<long long> times;
+  vector<double> watts;
+  for (; block != m_blocks.end() && block->m_first < to; ++block) {
+    long long first = (block->m_first - from) / width;
+    if (block->m_first >= from && block->m_last < to &&
+        first == (block->m_last - from) / width) {
+      buckets[first].merge(block->m_summary); // one bucket holds it all
+      continue;
+    }
+    times.clear();
+    watts.clear();
+    decode(*block, times, watts);
+    for (int i = 0; i < (int)times.size(); i++) {
+      if (times[i] >= from && times[i] < to) {
+        buckets[(times[i] - from) / width].add(watts[i]);
+      }
+    }
+  }
+}
+
+void MeterSeries::read(long long from, long long to, vector<long long> &times,
+                       vector<double> &watts) const {
+  vector<long long> blockTimes;
+  vector<double> blockWatts;
+  for (const Block &block : m_blocks) {
+    if (block.m_last < from || block.m_first >= to) {
+      continue;
+    }
+    blockTimes.clear();
+    blockWatts.clear();
+    decode(block, blockTimes, blockWatts);
+    for (int i = 0; i < (int)blockTimes.size(); i++) {
+      if (blockTimes[i] >= from && blockTimes[i] < to) {
+        times.push_back(blockTimes[i]);
+        watts.push_back(blockWatts[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef WPMETER_H
+#define WPMETER_H
+#include "wpower.h"
+#include <cstdint>
+
+// Append-only power readings of one customer, compressed like Gorilla.
+// Readings are cut into blocks of at most METER_BLOCK samples that never
+// span two METER_WINDOW windows, each with a time column and a value column:
+//   time:  the first raw, then the delta of deltas as '0' for 0, '10' + 7
+//          bits, '110' + 9 bits, '1110' + 12 bits or '1111' + 64 bits
+//   value: the first raw, then the XOR with the previous value as '0' when
+//          equal, '10' + the meaningful bits when they fit the previous
+//          leading and trailing zeros, '11' + 5 bits of leading zeros + 6
+//          bits of length - 1 + the meaningful bits otherwise
+// A regular reading costs one bit of time, a repeated value one bit.
+// Every block also keeps its count, sum and max, so a query window that
+// covers a whole block never decodes it, and a rollup whose start and width
+// are multiples of METER_WINDOW decodes nothing.
+
+#define METER_BLOCK 256   // samples per block at most
+#define METER_WINDOW 3600 // seconds
+
+class MeterSeries {
+public:
+  MeterSeries();
+
+  // returns false if time is before the last reading
+  bool append(long long time, double watts);
+  int size() const;
+  size_t bytes() const; // compressed size of both columns
+  // readings with time in [from, to)
+  MeterAggregate aggregate(long long from, long long to) const;
+  // adds every reading with time in [from, to) to buckets[(time - from) /
+  // width]
+  void rollup(long long from, long long to, long long width,
+              vector<MeterAggregate> &buckets) const;
+  void read(long long from, long long to, vector<long long> &times,
+            vector<double> &watts) const;
+
+private:
+  struct Block {
+    long long m_first; // time of the first and last reading
+    long long m_last;
+    MeterAggregate m_summary;
+    vector<uint64_t> m_times;
+    vector<uint64_t> m_values;
+  };
+  vector<Block> m_blocks;
+  // encoder state of the last block
+  int m_timeBits;
+  int m_valueBits;
+  long long m_delta;
+  uint64_t m_previous; // bits of the last value
+  int m_leading;       // window of the last '11' value, -1 before one
+  int m_trailing;
+
+  void decode(const Block &block, vector<long long> &times,
+              vector<double> &watts) const;
+};
+
+#endif
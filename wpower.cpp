@@ -1,55 +1,319 @@
 #include "wpower.h"
+#include "wplog.h"
+#include "wpmeter.h"
+#include "wpskip.h"
+#include "wpsmall.h"
+#include "wpstats.h"
+#include "wptiles.h"
+#include "wptrace.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <future>
+#include <new>
+#include <random>
+#include <unordered_map>
 #define SPACE 10 // for print 2D function for testing purposes
+// applyBatch goes op by op below these batch sizes, where the joins cost
+// more than they save (measured by bench on about 45000 customers)
+#define BATCH_MIN_OPS 200
+#define BATCH_MIN_OPS_RB 2000
+
+// times one public operation into stats, does nothing when stats is null
+class ProfileScope {
+public:
+  ProfileScope(LatencyStats *stats, OPTYPE op, TREETYPE type, int id,
+               int &path, int &rotations)
+      : m_stats(stats), m_op(op), m_type(type), m_id(id), m_path(path),
+        m_rotations(rotations) {
+    if (m_stats != nullptr) {
+      path = 0;
+      rotations = 0;
+      m_start = std::chrono::steady_clock::now();
+    }
+  }
+  ~ProfileScope() {
+    if (m_stats != nullptr) {
+      long long nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - m_start)
+                            .count();
+      m_stats->record(m_op, m_type, m_id, m_start, nanos, m_path,
+                      m_rotations);
+    }
+  }
+
+private:
+  LatencyStats *m_stats;
+  OPTYPE m_op;
+  TREETYPE m_type;
+  int m_id;
+  int &m_path;
+  int &m_rotations;
+  std::chrono::steady_clock::time_point m_start;
+};
 
 WirelessPower::WirelessPower(TREETYPE type) {
   m_type = type;
   m_root = nullptr;
+  m_convertRoot = nullptr;
+  m_convertAdded = nullptr;
+  m_convertBudget = 0;
+  m_log = nullptr;
+  m_trace = nullptr;
+  m_hashing = false;
+  m_counting = false;
+  m_capacity = 0;
+  m_compacting = false;
+  m_compactNext = LLONG_MIN;
+  m_stats = nullptr;
+  m_visits = 0;
+  m_rotations = 0;
+  m_splayPolicy = SPLAY_FULL;
+  m_splayParameter = 0;
+  m_splayRandom = 0x9E3779B97F4A7C15ULL;
+  m_tiles = nullptr;
+  m_skip = (type == SKIPLIST) ? new LockFreeSkipList() : nullptr;
+  m_small = nullptr;
 }
 
-WirelessPower::~WirelessPower() { clear(); }
+WirelessPower::~WirelessPower() {
+  clear();
+  delete m_tiles;
+  delete m_stats;
+  delete m_skip;
+  delete m_small;
+  setMetering(false);
+}
 
-void WirelessPower::clear() { clear(m_root); }
+void WirelessPower::clear() {
+  clear(m_root);
+  clear(m_convertRoot);
+  clear(m_convertAdded);
+  m_root = nullptr;
+  m_convertRoot = nullptr;
+  m_convertAdded = nullptr;
+  m_convertRemoved.clear();
+  m_oldSpine.clear();
+  m_newSpine.clear();
+  m_finger.clear();
+  if (m_tiles != nullptr) {
+    m_tiles->clear();
+  }
+  if (m_skip != nullptr) {
+    m_skip->clear();
+  }
+  if (m_small != nullptr) {
+    m_small->clear();
+  }
+  for (MeterSeries *&series : m_meters) {
+    delete series;
+    series = nullptr;
+  }
+  for (const pair<const Customer *const, NodeBlock> &block : m_blocks) {
+    ::operator delete((void *)block.first); // every node is gone
+  }
+  m_blocks.clear();
+}
 
 void WirelessPower::clear(Customer *customer) {
   if (customer != nullptr) {
     clear(customer->m_left);
     clear(customer->m_right);
-    delete customer;
-    customer = nullptr;
+    freeNode(customer);
   }
 }
 
 void WirelessPower::insert(const Customer &customer) {
+  if (m_skip != nullptr) { // may run on many threads, only the log is kept
+    if (m_log == nullptr) {
+      m_skip->insert(customer.getID(), customer.getLatitude(),
+                     customer.getLongitude());
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_skip->idLock(customer.getID()));
+    m_log->logInsert(customer);
+    m_skip->insert(customer.getID(), customer.getLatitude(),
+                   customer.getLongitude());
+    return;
+  }
+  ProfileScope scope(m_stats, OP_INSERT, m_type, customer.getID(), m_visits,
+                     m_rotations);
+  m_finger.clear(); // any path from m_root may change below
+  recordInsert(customer);
+  if (m_small != nullptr) {
+    if (m_small->insert(customer.getID(), customer.getLatitude(),
+                        customer.getLongitude())) {
+      return;
+    }
+    promote(); // full, the customer goes into the new tree below
+  }
+  if (isConverting()) {
+    insertConverting(customer);
+    step(m_convertBudget);
+    return;
+  }
   switch (m_type) {
   case BST:
-    m_root = insert(m_root, customer);
+    m_root = insert<BST>(m_root, customer);
     break;
   case AVL:
-    m_root = insert(m_root, customer);
+    m_root = insert<AVL>(m_root, customer);
     break;
   case SPLAY:
-    m_root = insert(m_root, customer);
+    if (m_splayPolicy == SPLAY_FULL) {
+      m_root = insert<SPLAY>(m_root, customer);
+    } else { // insert as a leaf, then adjust like any other access
+      m_root = insert<BST>(m_root, customer);
+      splayAccess(customer.getID());
+    }
+    if (m_capacity > 0 &&
+        getSize(m_root) > m_capacity + max(1, m_capacity / 8)) {
+      evict(); // the slack makes each pass O(1) amortized per insert
+    }
+    break;
+  case REDBLACK:
+    m_root = insertRB(m_root, customer);
+    m_root->setRed(false); // the root is always black
     break;
+  case SKIPLIST: // handled above
+    break;
+  }
+}
+
+void WirelessPower::recordInsert(const Customer &customer) {
+  if (m_log != nullptr) {
+    m_log->logInsert(customer);
+  }
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_INSERT, customer.getID(), customer.getLatitude(),
+                    customer.getLongitude());
+  }
+  if (m_tiles != nullptr && !find(customer.getID())) {
+    m_tiles->add(customer.getLatitude(), customer.getLongitude(), 1);
+  }
+}
+
+void WirelessPower::insertHinted(const Customer &customer) {
+  if (m_type == SPLAY || m_type == SKIPLIST || isConverting() ||
+      m_small != nullptr) {
+    insert(customer); // splaying already starts next to the last insert
+    return;
+  }
+  ProfileScope scope(m_stats, OP_INSERT_HINTED, m_type, customer.getID(),
+                     m_visits, m_rotations);
+  recordInsert(customer);
+  int id = customer.getID();
+  // climb to the deepest finger node whose subtree can hold id
+  while (!m_finger.empty() &&
+         (id <= m_finger.back().m_low || id >= m_finger.back().m_high)) {
+    m_finger.pop_back();
+  }
+  if (m_finger.empty() && m_root != nullptr) {
+    m_finger.push_back(Finger{m_root, LLONG_MIN, LLONG_MAX});
+  }
+  if (!descendFinger(id)) {
+    return; // duplicate ids are ignored
+  }
+  Customer *added = new Customer(customer);
+  added->setLeft(nullptr);
+  added->setRight(nullptr);
+  added->setRed(m_type == REDBLACK);
+  updateHeight(added);
+  if (m_finger.empty()) {
+    m_root = added;
+    m_root->setRed(false);
+    m_finger.push_back(Finger{added, LLONG_MIN, LLONG_MAX});
+    return;
+  }
+  Finger parent = m_finger.back();
+  if (id < parent.m_customer->getID()) {
+    parent.m_customer->setLeft(added);
+    m_finger.push_back(Finger{added, parent.m_low, parent.m_customer->getID()});
+  } else {
+    parent.m_customer->setRight(added);
+    m_finger.push_back(
+        Finger{added, parent.m_customer->getID(), parent.m_high});
+  }
+
+  // rebalance back up the finger until nothing above can change
+  for (int i = (int)m_finger.size() - 2; i >= 0; i--) {
+    Customer *ancestor = m_finger[i].m_customer;
+    int oldHeight = ancestor->getHeight();
+    bool oldRed = ancestor->isRed();
+    updateHeight(ancestor);
+    Customer *top = ancestor;
+    if (m_type == AVL) {
+      top = balance(ancestor);
+    } else if (m_type == REDBLACK) {
+      top = fixRedRed(ancestor);
+    }
+    if (top != m_finger[i].m_customer) { // rotated, relink and redo below
+      if (i == 0) {
+        m_root = top;
+      } else if (m_finger[i - 1].m_customer->getLeft() ==
+                 m_finger[i].m_customer) {
+        m_finger[i - 1].m_customer->setLeft(top);
+      } else {
+        m_finger[i - 1].m_customer->setRight(top);
+      }
+      m_finger.resize(i + 1); // top covers the same id range
+      m_finger[i].m_customer = top;
+      descendFinger(id);
+    } else if (top->getHeight() == oldHeight && top->isRed() == oldRed &&
+               !(isRed(top) &&
+                 (isRed(top->getLeft()) || isRed(top->getRight()))) &&
+               !m_hashing && !m_counting) {
+      break; // hashes and sizes change all the way up to the root
+    }
   }
+  if (m_type == REDBLACK) {
+    m_root->setRed(false);
+  }
+}
+
+bool WirelessPower::descendFinger(int id) {
+  // extends the finger towards id, false if id is already in the tree
+  while (!m_finger.empty()) {
+    m_visits++;
+    Finger last = m_finger.back();
+    int lastID = last.m_customer->getID();
+    if (id == lastID) {
+      return false;
+    }
+    Customer *next = (id < lastID) ? last.m_customer->getLeft()
+                                   : last.m_customer->getRight();
+    if (next == nullptr) {
+      return true;
+    }
+    if (id < lastID) {
+      m_finger.push_back(Finger{next, last.m_low, lastID});
+    } else {
+      m_finger.push_back(Finger{next, lastID, last.m_high});
+    }
+  }
+  return true;
 }
 
+template <TREETYPE type>
 Customer *&WirelessPower::insert(Customer *&root, const Customer &customer) {
+  m_visits++;
   if (root == nullptr) {
     root = new Customer(customer); // creates a new node with customer
+    updateHeight(root);
   }
   if (customer.getID() != root->getID()) {  // if we haven't found id yet
     if (customer.getID() < root->getID()) { // move left
       Customer *leftChild = root->getLeft();
-      root->setLeft(insert(leftChild, customer));  // keep moving left
+      root->setLeft(insert<type>(leftChild, customer)); // keep moving left
     } else if (customer.getID() > root->getID()) { // move right
       Customer *rightChild = root->getRight();
-      root->setRight(insert(rightChild, customer)); // keep moving right
+      root->setRight(insert<type>(rightChild, customer)); // keep moving right
     }
     if (root != nullptr) {
       updateHeight(root); // update height
-      if (m_type == AVL) {
+      if constexpr (type == AVL) {
         root = balance(root); // balance if avl type
-      } else if (m_type == SPLAY) {
+      } else if constexpr (type == SPLAY) {
         root = splay(root, customer); // splay rotations if splay type
       }
     }
@@ -70,7 +334,7 @@ Customer *&WirelessPower::balance(Customer *&root) {
       }
     } else if (getBalanceFactor(root) < -1) {
       Customer *right = root->getRight();
-      if (getBalanceFactor(right) >= 0) { // check if greater than or equal to 0
+      if (getBalanceFactor(right) <= 0) { // check if less than or equal to 0
         return rotateLeft(root);
       } else {
         root->setRight(
@@ -86,21 +350,14 @@ int WirelessPower::getBalanceFactor(const Customer *customer) const {
   if (customer == nullptr) {
     return 0;
   }
-  int leftHeight = 0;
-  int rightHeight = 0;
-
-  if (customer->getLeft() != nullptr) // if we have a left child
-  {
-    leftHeight = (customer->getLeft()->getHeight()); // keep the height
-  }
-  if (customer->getRight() != nullptr) // if we have a right child
-  {
-    rightHeight = (customer->getRight()->getHeight()); // keep the height
-  }
+  // a missing child counts as -1 so it is one below a leaf
+  int leftHeight = getHeight(customer->getLeft());
+  int rightHeight = getHeight(customer->getRight());
   return leftHeight - rightHeight; // get the factor of both
 }
 
 Customer *&WirelessPower::rotateRight(Customer *&customer) {
+  m_rotations++;
   if (customer != nullptr && customer->getLeft() != nullptr) {
     Customer *newRoot = customer->getLeft();
     Customer *right = newRoot->getRight();
@@ -115,6 +372,7 @@ Customer *&WirelessPower::rotateRight(Customer *&customer) {
 }
 
 Customer *&WirelessPower::rotateLeft(Customer *&customer) {
+  m_rotations++;
   // complete opposite of rotate right
   if (customer != nullptr && customer->getRight() != nullptr) {
     Customer *newRoot = customer->getRight();
@@ -143,14 +401,14 @@ Customer *&WirelessPower::rotateRightLeft(Customer *&customer) {
   // opposite of zig zag
   if (customer != nullptr && customer->getRight() != nullptr) {
     Customer *right = customer->getRight();
-    customer->setLeft(rotateRight(right));
+    customer->setRight(rotateRight(right));
     customer = rotateLeft(customer);
   }
   return customer;
 }
 
 Customer *&WirelessPower::splay(Customer *&root, const Customer &customer) {
-
+  m_visits++;
   if (customer.getID() < root->getID()) // if id is less the roots id move left
   {
     if (root->getLeft() == nullptr) // once there are no left children
@@ -220,29 +478,288 @@ void WirelessPower::updateHeight(Customer *customer) {
   }
   customer->setHeight(
       1 + max(getHeight(customer->getLeft()), getHeight(customer->getRight())));
+  if (m_hashing) { // every structural change already passes through here
+    customer->m_hash = nodeHash(customer) + getHash(customer->getLeft()) +
+                       getHash(customer->getRight());
+  }
+  if (m_counting) {
+    customer->m_size =
+        1 + getSize(customer->getLeft()) + getSize(customer->getRight());
+  }
+}
+
+bool WirelessPower::isRed(const Customer *customer) const {
+  return customer != nullptr && customer->isRed();
+}
+
+Customer *WirelessPower::insertRB(Customer *root, const Customer &customer) {
+  m_visits++;
+  if (root == nullptr) {
+    Customer *newNode = new Customer(customer);
+    newNode->setLeft(nullptr);
+    newNode->setRight(nullptr);
+    updateHeight(newNode);
+    newNode->setRed(true); // new nodes are always red
+    return newNode;
+  }
+  if (customer.getID() < root->getID()) {
+    root->setLeft(insertRB(root->getLeft(), customer));
+  } else if (customer.getID() > root->getID()) {
+    root->setRight(insertRB(root->getRight(), customer));
+  } else {
+    return root; // duplicate ids are ignored
+  }
+  updateHeight(root);
+  return fixRedRed(root);
+}
+
+Customer *WirelessPower::fixRedRed(Customer *root) {
+  Customer *left = root->getLeft();
+  Customer *right = root->getRight();
+  bool leftViolation =
+      isRed(left) && (isRed(left->getLeft()) || isRed(left->getRight()));
+  bool rightViolation =
+      isRed(right) && (isRed(right->getLeft()) || isRed(right->getRight()));
+
+  if (!leftViolation && !rightViolation) {
+    return root;
+  }
+  if (isRed(left) && isRed(right)) { // red uncle, push the red up a level
+    root->setRed(true);
+    left->setRed(false);
+    right->setRed(false);
+    return root;
+  }
+  if (leftViolation) {
+    if (isRed(left->getRight())) { // zig zag, straighten it first
+      root->setLeft(rotateLeft(left));
+    }
+    root->setRed(true);
+    root = rotateRight(root);
+  } else {
+    if (isRed(right->getLeft())) { // zag zig
+      root->setRight(rotateRight(right));
+    }
+    root->setRed(true);
+    root = rotateLeft(root);
+  }
+  root->setRed(false);
+  return root;
+}
+
+Customer *WirelessPower::removeRB(Customer *root, int id, bool &shorter) {
+  m_visits++;
+  if (root == nullptr) {
+    shorter = false;
+    return root;
+  }
+  if (id < root->getID()) {
+    root->setLeft(removeRB(root->getLeft(), id, shorter));
+    if (shorter) {
+      root = fixLeftShort(root, shorter);
+    }
+  } else if (id > root->getID()) {
+    root->setRight(removeRB(root->getRight(), id, shorter));
+    if (shorter) {
+      root = fixRightShort(root, shorter);
+    }
+  } else if (root->getLeft() == nullptr || root->getRight() == nullptr) {
+    Customer *child =
+        (root->getLeft() != nullptr) ? root->getLeft() : root->getRight();
+    shorter = !root->isRed();
+    if (isRed(child)) { // a lone red child takes over the black
+      child->setRed(false);
+      shorter = false;
+    }
+    freeNode(root);
+    return child;
+  } else {
+    // relink the successor in place of root instead of copying it
+    Customer *successor = nullptr;
+    Customer *right = removeMinRB(root->getRight(), successor, shorter);
+    successor->setLeft(root->getLeft());
+    successor->setRight(right);
+    successor->setRed(root->isRed());
+    freeNode(root);
+    root = successor;
+    if (shorter) {
+      root = fixRightShort(root, shorter);
+    }
+  }
+  updateHeight(root);
+  return root;
+}
+
+Customer *WirelessPower::removeMinRB(Customer *root, Customer *&min,
+                                     bool &shorter) {
+  if (root->getLeft() == nullptr) {
+    Customer *child = root->getRight();
+    min = root;
+    shorter = !root->isRed();
+    if (isRed(child)) {
+      child->setRed(false);
+      shorter = false;
+    }
+    return child;
+  }
+  root->setLeft(removeMinRB(root->getLeft(), min, shorter));
+  if (shorter) {
+    root = fixLeftShort(root, shorter);
+  }
+  updateHeight(root);
+  return root;
+}
+
+Customer *WirelessPower::fixLeftShort(Customer *root, bool &shorter) {
+  Customer *sibling = root->getRight();
+  if (isRed(sibling)) { // red sibling, rotate so the sibling is black
+    root->setRed(true);
+    sibling->setRed(false);
+    Customer *top = rotateLeft(root);
+    top->setLeft(fixLeftShort(top->getLeft(), shorter));
+    updateHeight(top);
+    return top;
+  }
+  if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+    sibling->setRed(true); // recolor and push the missing black up
+    shorter = !root->isRed();
+    root->setRed(false);
+    return root;
+  }
+  if (!isRed(sibling->getRight())) { // near nephew is red
+    sibling->setRed(true);
+    sibling->getLeft()->setRed(false);
+    root->setRight(rotateRight(sibling));
+    sibling = root->getRight();
+  }
+  sibling->setRed(root->isRed());
+  root->setRed(false);
+  sibling->getRight()->setRed(false);
+  shorter = false;
+  return rotateLeft(root);
+}
+
+Customer *WirelessPower::fixRightShort(Customer *root, bool &shorter) {
+  // mirror image of fixLeftShort
+  Customer *sibling = root->getLeft();
+  if (isRed(sibling)) {
+    root->setRed(true);
+    sibling->setRed(false);
+    Customer *top = rotateRight(root);
+    top->setRight(fixRightShort(top->getRight(), shorter));
+    updateHeight(top);
+    return top;
+  }
+  if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+    sibling->setRed(true);
+    shorter = !root->isRed();
+    root->setRed(false);
+    return root;
+  }
+  if (!isRed(sibling->getLeft())) {
+    sibling->setRed(true);
+    sibling->getRight()->setRed(false);
+    root->setLeft(rotateLeft(sibling));
+    sibling = root->getLeft();
+  }
+  sibling->setRed(root->isRed());
+  root->setRed(false);
+  sibling->getLeft()->setRed(false);
+  shorter = false;
+  return rotateRight(root);
+}
+
+void WirelessPower::colorFromHeights(Customer *customer, int parentHeight) {
+  if (customer == nullptr) {
+    return;
+  }
+  // a node is red when it sits one below a parent of odd height, this gives
+  // equal black heights on every path and never two reds in a row
+  customer->setRed(parentHeight % 2 == 1 &&
+                   customer->getHeight() == parentHeight - 1);
+  colorFromHeights(customer->getLeft(), customer->getHeight());
+  colorFromHeights(customer->getRight(), customer->getHeight());
 }
 
 void WirelessPower::remove(int id) {
+  if (m_skip != nullptr) {
+    if (m_log == nullptr && m_meters.empty()) {
+      m_skip->remove(id);
+      return;
+    }
+    // readings kept from before the list go with the customer, as in a tree
+    std::lock_guard<std::mutex> lock(m_skip->idLock(id));
+    if (m_log != nullptr) {
+      m_log->logRemove(id);
+    }
+    if (m_skip->remove(id)) {
+      dropReadings(id);
+    }
+    return;
+  }
+  ProfileScope scope(m_stats, OP_REMOVE, m_type, id, m_visits, m_rotations);
+  if (m_type == SPLAY) {
+    return; // splay trees never remove, so there is nothing to log
+  }
+  m_finger.clear();
+  if (m_log != nullptr) {
+    m_log->logRemove(id);
+  }
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_REMOVE, id);
+  }
+  if (m_tiles != nullptr) {
+    const Customer *customer = findNode(id);
+    int index = (m_small == nullptr) ? -1 : m_small->find(id);
+    if (customer != nullptr) {
+      m_tiles->add(customer->getLatitude(), customer->getLongitude(), -1);
+    } else if (index >= 0) {
+      m_tiles->add(m_small->getLatitude(index), m_small->getLongitude(index),
+                   -1);
+    }
+  }
+  dropReadings(id);
+  if (m_small != nullptr) {
+    m_small->remove(id);
+    return;
+  }
+  if (isConverting()) {
+    removeConverting(id);
+    step(m_convertBudget);
+    return;
+  }
   switch (m_type) {
   case BST:
-    m_root = remove(m_root, id);
+    m_root = remove<BST>(m_root, id);
     break;
   case AVL:
-    m_root = remove(m_root, id);
+    m_root = remove<AVL>(m_root, id);
     m_root = balance(m_root);
     break;
-  case SPLAY:
+  case SPLAY: // returned above
+    break;
+  case REDBLACK: {
+    bool shorter = false;
+    m_root = removeRB(m_root, id, shorter);
+    if (m_root != nullptr) {
+      m_root->setRed(false);
+    }
+    break;
+  }
+  case SKIPLIST:
     break;
   }
 }
 
+template <TREETYPE type>
 Customer *&WirelessPower::remove(Customer *&root, int id) {
+  m_visits++;
   if (root != nullptr) {
     if (id == root->getID()) {
       if (root->getLeft() == nullptr &&
           root->getRight() == nullptr) // delete root that we are currently at
       {
-        delete root;
+        freeNode(root);
         root = nullptr;
       } else if (root->getLeft() == nullptr &&
                  root->getRight() != nullptr) // delete node and move right node
@@ -250,14 +767,14 @@ Customer *&WirelessPower::remove(Customer *&root, int id) {
       {
         Customer *oldRoot = root;
         root = root->getRight();
-        delete oldRoot;
+        freeNode(oldRoot);
         oldRoot = nullptr;
       } else if (root->getLeft() != nullptr &&
                  root->getRight() == nullptr) // samething just left now
       {
         Customer *oldRoot = root;
         root = root->getLeft();
-        delete oldRoot;
+        freeNode(oldRoot);
         oldRoot = nullptr;
       } else if (root->getLeft() != nullptr &&
                  root->getRight() != nullptr) // both have data
@@ -275,23 +792,23 @@ Customer *&WirelessPower::remove(Customer *&root, int id) {
         root->setLeft(oldRoot->getLeft());   // set left node of newnode
         root->setRight(oldRoot->getRight()); // set right of newnode
 
-        delete oldRoot;
+        freeNode(oldRoot);
         oldRoot = nullptr;
 
         Customer *rightChild = root->getRight();
-        root->setRight(remove(rightChild, successor->getID()));
+        root->setRight(remove<type>(rightChild, successor->getID()));
       }
     } else if (id < root->getID()) {
       Customer *leftChild = root->getLeft();
-      root->setLeft(remove(leftChild, id));
+      root->setLeft(remove<type>(leftChild, id));
     } else if (id > root->getID()) {
       Customer *rightChild = root->getRight();
-      root->setRight(remove(rightChild, id));
+      root->setRight(remove<type>(rightChild, id));
     }
 
     if (root != nullptr) {
       updateHeight(root);
-      if (m_type == AVL) {
+      if constexpr (type == AVL) {
         root = balance(root);
       }
     }
@@ -331,129 +848,1949 @@ bool WirelessPower::checkBalance(const Customer *customer) const {
   return isBalanced;
 }
 
-Customer *&WirelessPower::restructureIntoAVL(Customer *&root) {
-  if (root == nullptr) {
-    return root;
+void WirelessPower::removeRange(int low, int high) {
+  m_finger.clear();
+  finishConversion();
+  if (m_type == SPLAY || low > high) {
+    return; // same as remove(), splay trees never remove
   }
-  Customer *leftChild = root->getLeft();
-  Customer *rightChild = root->getRight();
-  root->setLeft(restructureIntoAVL(leftChild));
-  root->setRight(restructureIntoAVL(rightChild));
-
-  updateHeight(root);
-  root = balance(root);
-
-  return root;
+  if (m_skip != nullptr || m_small != nullptr) {
+    vector<Customer *> nodes;
+    contents(nodes);
+    for (Customer *customer : nodes) {
+      if (customer->getID() >= low && customer->getID() <= high) {
+        remove(customer->getID());
+      }
+      delete customer;
+    }
+    return;
+  }
+  Customer *less = nullptr;
+  Customer *rest = nullptr;
+  Customer *middle = nullptr;
+  Customer *greater = nullptr;
+  split(m_root, low, less, rest);
+  split(rest, (long long)high + 1, middle, greater);
+  discard(middle);
+  m_root = join2(less, greater);
 }
 
-void WirelessPower::setType(TREETYPE type) {
-  if (m_type != type) {
-    m_type = type;
-    if (m_type == AVL) {
-      m_root = restructureIntoAVL(m_root);
+void WirelessPower::removeBatch(vector<int> ids) {
+  m_finger.clear();
+  finishConversion();
+  if (m_type == SPLAY || ids.empty()) {
+    return;
+  }
+  if (m_skip != nullptr || m_small != nullptr) {
+    for (int id : ids) {
+      remove(id);
     }
+    return;
   }
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  m_root = removeBatch(m_root, ids, 0, (int)ids.size() - 1);
 }
-bool WirelessPower::operator==(const WirelessPower &rhs) const {
-  if ((m_root != nullptr && rhs.m_root == nullptr) ||
-      (m_root == nullptr && rhs.m_root != nullptr)) {
-    return false;
-  } else if (m_root == nullptr && rhs.m_root == nullptr) {
-    return true;
-  }
 
-  return equalityOperator(m_root, rhs.m_root);
+Customer *WirelessPower::removeBatch(Customer *root, const vector<int> &ids,
+                                     int low, int high) {
+  if (root == nullptr || low > high) {
+    return root; // nothing to remove below here
+  }
+  // ids[low..split-1] are left of root, ids[split..high] are not
+  int split =
+      lower_bound(ids.begin() + low, ids.begin() + high + 1, root->getID()) -
+      ids.begin();
+  bool removed = split <= high && ids[split] == root->getID();
+  Customer *left = removeBatch(root->getLeft(), ids, low, split - 1);
+  Customer *right =
+      removeBatch(root->getRight(), ids, removed ? split + 1 : split, high);
+  if (removed) {
+    root->setLeft(nullptr);
+    root->setRight(nullptr);
+    discard(root);
+    return join2(left, right);
+  }
+  return join(left, root, right);
 }
 
-bool WirelessPower::equalityOperator(const Customer *lhs,
-                                     const Customer *rhs) const {
-  if (lhs == nullptr && rhs == nullptr) {
-    return true;
-  } else if (lhs == nullptr || rhs == nullptr) {
-    return false;
-  } else {
-    if (lhs->getID() != rhs->getID() || lhs->getHeight() != rhs->getHeight()) {
-      return false;
+void WirelessPower::applyBatch(vector<CustomerDelta> ops) {
+  int minOps = (m_type == REDBLACK) ? BATCH_MIN_OPS_RB : BATCH_MIN_OPS;
+  if (m_type == SPLAY || m_skip != nullptr || m_small != nullptr ||
+      (int)ops.size() < minOps) {
+    for (const CustomerDelta &op : ops) { // no joins, or too few to pay off
+      if (op.m_type == DELTA_INSERT) {
+        insert(Customer(op.m_id, op.m_latitude, op.m_longitude));
+      } else if (op.m_type == DELTA_REMOVE) {
+        remove(op.m_id);
+      } else if (m_skip != nullptr) {
+        moveSkip(op.m_id, op.m_latitude, op.m_longitude);
+      } else {
+        updateLocation(op.m_id, op.m_latitude, op.m_longitude);
+      }
     }
+    return;
   }
-  return (equalityOperator(lhs->getLeft(), rhs->getLeft()) &&
-          equalityOperator(lhs->getRight(), rhs->getRight()));
+  m_finger.clear();
+  finishConversion();
+  // ops on one id keep their order, ops on different ids commute
+  stable_sort(ops.begin(), ops.end(),
+              [](const CustomerDelta &a, const CustomerDelta &b) {
+                return a.m_id < b.m_id;
+              });
+  int black = blackHeight(m_root);
+  m_root = applyBatch(m_root, ops, 0, (int)ops.size() - 1, black);
 }
 
-const WirelessPower &WirelessPower::operator=(const WirelessPower &rhs) {
-  if (!(*this == rhs)) {
-    if (m_root != nullptr) {
-      clear();
+void WirelessPower::moveSkip(int id, double lat, double longitude) {
+  std::lock_guard<std::mutex> lock(m_skip->idLock(id));
+  if (!m_skip->remove(id)) {
+    return; // an update of an absent id is dropped
+  }
+  if (m_log != nullptr) { // replays as a move, like updateLocation()
+    m_log->logRemove(id);
+    m_log->logInsert(Customer(id, lat, longitude));
+  }
+  m_skip->insert(id, lat, longitude); // readings stay with the id
+}
+
+Customer *WirelessPower::applyBatch(Customer *root,
+                                    const vector<CustomerDelta> &ops, int low,
+                                    int high, int &black) {
+  if (low > high) {
+    return root; // nothing changes below here
+  }
+  if (root == nullptr && ops[low].m_id == ops[high].m_id) {
+    root = applyOps(nullptr, ops, low, high); // the common single new leaf
+    updateHeight(root);
+    black = (root == nullptr) ? 0 : 1;
+    return root;
+  }
+  if (root == nullptr) { // every id in ops[low..high] starts out absent
+    vector<Customer *> nodes;
+    for (int first = low, last = low; first <= high; first = last) {
+      while (last <= high && ops[last].m_id == ops[first].m_id) {
+        last++;
+      }
+      Customer *customer = applyOps(nullptr, ops, first, last - 1);
+      if (customer != nullptr) {
+        nodes.push_back(customer);
+      }
     }
-    if (rhs.m_root == nullptr) {
-      return *this;
+    Customer *built = buildBalanced(nodes, 0, (int)nodes.size() - 1);
+    if (m_type == REDBLACK) {
+      colorFromHeights(built, DEFAULT_HEIGHT - 1);
+      black = blackHeight(built);
     }
-    Customer *rhsRoot = rhs.m_root;
-    m_root = copyTree(rhsRoot);
+    return built;
   }
-  return *this;
+  // ops[low..first-1] are left of root, ops[first..last-1] are on root
+  auto below = [](const CustomerDelta &op, int id) { return op.m_id < id; };
+  auto above = [](int id, const CustomerDelta &op) { return id < op.m_id; };
+  int first = lower_bound(ops.begin() + low, ops.begin() + high + 1,
+                          root->getID(), below) -
+              ops.begin();
+  int last = upper_bound(ops.begin() + first, ops.begin() + high + 1,
+                         root->getID(), above) -
+             ops.begin();
+  int leftBlack = black - (isRed(root) ? 0 : 1);
+  int rightBlack = leftBlack;
+  Customer *left = applyBatch(root->getLeft(), ops, low, first - 1, leftBlack);
+  Customer *right = applyBatch(root->getRight(), ops, last, high, rightBlack);
+  root->setLeft(nullptr);
+  root->setRight(nullptr);
+  root = applyOps(root, ops, first, last - 1);
+  if (root == nullptr) {
+    root = join2(left, right);
+    black = (m_type == REDBLACK) ? blackHeight(root) : 0;
+    return root;
+  }
+  if (m_type == REDBLACK) {
+    return joinRB(left, root, right, leftBlack, rightBlack, black);
+  }
+  return join(left, root, right);
 }
 
-Customer *WirelessPower::copyTree(Customer *&root) {
-  Customer *newNode = nullptr;
-  if (root != nullptr) {
-    newNode = new Customer(*root);
-
-    Customer *leftChild = root->getLeft();
-    Customer *rightChild = root->getRight();
-    newNode->setLeft(copyTree(leftChild));
-    newNode->setRight(copyTree(rightChild));
-
-    return newNode;
+Customer *WirelessPower::applyOps(Customer *customer,
+                                  const vector<CustomerDelta> &ops, int low,
+                                  int high) {
+  // the log, trace, tiles and readings change as the single calls would
+  for (int i = low; i <= high; i++) {
+    const CustomerDelta &op = ops[i];
+    if (op.m_type == DELTA_INSERT) {
+      Customer added(op.m_id, op.m_latitude, op.m_longitude);
+      if (m_log != nullptr) {
+        m_log->logInsert(added);
+      }
+      if (m_trace != nullptr) {
+        m_trace->record(TRACE_INSERT, op.m_id, op.m_latitude, op.m_longitude);
+      }
+      if (customer == nullptr) { // a present id keeps its location
+        if (m_tiles != nullptr) {
+          m_tiles->add(op.m_latitude, op.m_longitude, 1);
+        }
+        customer = new Customer(added);
+      }
+    } else if (op.m_type == DELTA_REMOVE) {
+      if (m_log != nullptr) {
+        m_log->logRemove(op.m_id);
+      }
+      if (m_trace != nullptr) {
+        m_trace->record(TRACE_REMOVE, op.m_id);
+      }
+      if (customer != nullptr) {
+        if (m_tiles != nullptr) {
+          m_tiles->add(customer->getLatitude(), customer->getLongitude(), -1);
+        }
+        freeNode(customer);
+        customer = nullptr;
+      }
+      dropReadings(op.m_id);
+    } else if (customer != nullptr) { // an update of an absent id is dropped
+      if (m_log != nullptr) {
+        m_log->logRemove(op.m_id);
+        m_log->logInsert(Customer(op.m_id, op.m_latitude, op.m_longitude));
+      }
+      if (m_tiles != nullptr) {
+        m_tiles->add(customer->getLatitude(), customer->getLongitude(), -1);
+        m_tiles->add(op.m_latitude, op.m_longitude, 1);
+      }
+      customer->setLatitude(op.m_latitude);
+      customer->setLongitude(op.m_longitude);
+    }
   }
-  return newNode;
+  return customer;
 }
 
-void WirelessPower::dumpTree() const { dump(m_root); }
-
-void WirelessPower::dump(Customer *customer) const {
+void WirelessPower::discard(Customer *customer) {
   if (customer != nullptr) {
-    cout << "(";
-    dump(customer->m_left); // first visit the left child
-    cout << customer->m_id << ":"
-         << customer->m_height; // second visit the node itself
-    dump(customer->m_right);    // third visit the right child
-    cout << ")";
+    discard(customer->getLeft());
+    discard(customer->getRight());
+    if (m_log != nullptr) {
+      m_log->logRemove(customer->getID());
+    }
+    if (m_trace != nullptr) {
+      m_trace->record(TRACE_REMOVE, customer->getID());
+    }
+    if (m_tiles != nullptr) {
+      m_tiles->add(customer->getLatitude(), customer->getLongitude(), -1);
+    }
+    dropReadings(customer->getID());
+    freeNode(customer);
   }
 }
 
-ostream &operator<<(ostream &sout, const Customer &x) {
-  sout << x.m_id << " (" << x.getLatStr() << ", " << x.getLongStr() << ")"
-       << endl;
-  ;
-  return sout;
+Customer *WirelessPower::join(Customer *left, Customer *mid,
+                              Customer *right) {
+  if (m_type == AVL) {
+    return joinAVL(left, mid, right);
+  } else if (m_type == REDBLACK) {
+    return joinRB(left, mid, right);
+  }
+  mid->setLeft(left); // a plain BST keeps whatever shape it gets
+  mid->setRight(right);
+  updateHeight(mid);
+  return mid;
 }
 
-void WirelessPower::print2D(Customer *customer, int space) {
-  if (customer == nullptr) {
-    return;
+Customer *WirelessPower::joinAVL(Customer *left, Customer *mid,
+                                 Customer *right) {
+  // walk down the spine of the taller tree to a subtree of matching height
+  if (getHeight(left) > getHeight(right) + 1) {
+    left->setRight(joinAVL(left->getRight(), mid, right));
+    updateHeight(left);
+    return balance(left);
   }
-  space += SPACE;
-  print2D(customer->getRight(), space);
-  cout << endl;
-  for (int i = SPACE; i < space; i++) {
-    cout << " ";
+  if (getHeight(right) > getHeight(left) + 1) {
+    right->setLeft(joinAVL(left, mid, right->getLeft()));
+    updateHeight(right);
+    return balance(right);
   }
-  cout << customer->getID() << ":" << customer->getHeight() << endl;
-  print2D(customer->getLeft(), space);
+  mid->setLeft(left);
+  mid->setRight(right);
+  updateHeight(mid);
+  return mid;
 }
 
-Customer *WirelessPower::getRoot() { return m_root; }
-
-bool WirelessPower::checkPreservance() const {
-  bool isPreserved = true;
-  if (m_root != nullptr) {
-    isPreserved = checkPreservance(m_root);
+int WirelessPower::blackHeight(const Customer *customer) const {
+  int black = 0;
+  for (; customer != nullptr; customer = customer->getLeft()) {
+    black += customer->isRed() ? 0 : 1;
   }
-  return isPreserved;
+  return black;
 }
 
-bool WirelessPower::checkPreservance(const Customer *customer) const {
+Customer *WirelessPower::joinRB(Customer *left, Customer *mid,
+                                Customer *right) {
+  int black = 0;
+  return joinRB(left, mid, right, blackHeight(left), blackHeight(right),
+                black);
+}
+
+Customer *WirelessPower::joinRB(Customer *left, Customer *mid,
+                                Customer *right, int leftBlack,
+                                int rightBlack, int &black) {
+  // subtrees may come with a red root, a black root keeps them valid
+  if (isRed(left)) {
+    left->setRed(false);
+    leftBlack++;
+  }
+  if (isRed(right)) {
+    right->setRed(false);
+    rightBlack++;
+  }
+  Customer *root = nullptr;
+  if (leftBlack > rightBlack) {
+    root = joinRightRB(left, mid, right, leftBlack, rightBlack);
+    black = leftBlack + (root->isRed() ? 1 : 0); // a red root turns black
+  } else if (rightBlack > leftBlack) {
+    root = joinLeftRB(left, mid, right, leftBlack, rightBlack);
+    black = rightBlack + (root->isRed() ? 1 : 0);
+  } else {
+    mid->setLeft(left);
+    mid->setRight(right);
+    updateHeight(mid);
+    root = mid;
+    black = leftBlack + 1;
+  }
+  root->setRed(false);
+  return root;
+}
+
+Customer *WirelessPower::joinRightRB(Customer *root, Customer *mid,
+                                     Customer *right, int rootBlack,
+                                     int rightBlack) {
+  if (!isRed(root) && rootBlack == rightBlack) {
+    mid->setLeft(root); // a red mid adds no black height
+    mid->setRight(right);
+    mid->setRed(true);
+    updateHeight(mid);
+    return mid;
+  }
+  int childBlack = rootBlack - (root->isRed() ? 0 : 1);
+  root->setRight(
+      joinRightRB(root->getRight(), mid, right, childBlack, rightBlack));
+  updateHeight(root);
+  return fixRedRed(root);
+}
+
+Customer *WirelessPower::joinLeftRB(Customer *left, Customer *mid,
+                                    Customer *root, int leftBlack,
+                                    int rootBlack) {
+  // mirror image of joinRightRB
+  if (!isRed(root) && rootBlack == leftBlack) {
+    mid->setLeft(left);
+    mid->setRight(root);
+    mid->setRed(true);
+    updateHeight(mid);
+    return mid;
+  }
+  int childBlack = rootBlack - (root->isRed() ? 0 : 1);
+  root->setLeft(joinLeftRB(left, mid, root->getLeft(), leftBlack, childBlack));
+  updateHeight(root);
+  return fixRedRed(root);
+}
+
+Customer *WirelessPower::join2(Customer *left, Customer *right) {
+  if (left == nullptr) {
+    return right;
+  }
+  // the largest id of left becomes the middle node of a regular join
+  Customer *max = left;
+  while (max->getRight() != nullptr) {
+    max = max->getRight();
+  }
+  Customer *less = nullptr;
+  Customer *last = nullptr;
+  split(left, max->getID(), less, last);
+  return join(less, last, right);
+}
+
+void WirelessPower::split(Customer *root, long long id, Customer *&less,
+                          Customer *&rest) {
+  // less gets every id below id, rest every id from id up
+  if (root == nullptr) {
+    less = nullptr;
+    rest = nullptr;
+    return;
+  }
+  Customer *left = root->getLeft();
+  Customer *right = root->getRight();
+  if (root->getID() < id) {
+    Customer *middle = nullptr;
+    split(right, id, middle, rest);
+    less = join(left, root, middle);
+  } else {
+    Customer *middle = nullptr;
+    split(left, id, less, middle);
+    rest = join(middle, root, right);
+  }
+}
+
+Customer *&WirelessPower::restructureIntoAVL(Customer *&root) {
+  if (root == nullptr) {
+    return root;
+  }
+  // a single balance() per node cannot fix a degenerate BST or splay tree, so
+  // relink the existing nodes into a perfectly balanced tree instead
+  vector<Customer *> nodes;
+  flatten(root, nodes);
+  root = buildBalanced(nodes, 0, (int)nodes.size() - 1);
+
+  return root;
+}
+
+void WirelessPower::flatten(Customer *root, vector<Customer *> &nodes) const {
+  if (root != nullptr) {
+    flatten(root->getLeft(), nodes); // in-order keeps the ids sorted
+    nodes.push_back(root);
+    flatten(root->getRight(), nodes);
+  }
+}
+
+Customer *WirelessPower::buildBalanced(vector<Customer *> &nodes, int low,
+                                       int high) {
+  m_visits++;
+  if (low > high) {
+    return nullptr;
+  }
+  int mid = low + (high - low) / 2;
+  Customer *root = nodes[mid];
+  root->setLeft(buildBalanced(nodes, low, mid - 1));
+  root->setRight(buildBalanced(nodes, mid + 1, high));
+  updateHeight(root);
+  return root;
+}
+
+void WirelessPower::setType(TREETYPE type, int budget) {
+  ProfileScope scope(m_stats, OP_SETTYPE, m_type, type, m_visits,
+                     m_rotations);
+  m_finger.clear();
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_SETTYPE, type, budget);
+  }
+  finishConversion();
+  if (m_small != nullptr && type != SKIPLIST) {
+    m_type = type; // the array is built into the new type when it promotes
+    return;
+  } else if (m_small != nullptr) {
+    promote();
+  }
+  if (m_type != type && (m_type == SKIPLIST || type == SKIPLIST)) {
+    m_type = type;
+    convertSkipList();
+  } else if (m_type != type) {
+    m_type = type;
+    if (m_type == AVL && budget > 0 && m_root != nullptr) {
+      // hand every node to the pending tree, later operations move them back
+      m_convertRoot = m_root;
+      m_convertBudget = budget;
+      m_root = nullptr;
+    } else if (m_type == AVL) {
+      m_root = restructureIntoAVL(m_root);
+    } else if (m_type == REDBLACK) {
+      // every AVL tree can be colored red-black from its heights alone
+      m_root = restructureIntoAVL(m_root);
+      colorFromHeights(m_root, DEFAULT_HEIGHT - 1);
+    }
+  }
+}
+void WirelessPower::convertSkipList() {
+  vector<Customer *> nodes;
+  if (m_skip != nullptr) { // the list is already sorted, build it balanced
+    m_skip->collect(nodes);
+    delete m_skip;
+    m_skip = nullptr;
+  } else {
+    flatten(m_root, nodes);
+    m_skip = new LockFreeSkipList();
+    for (Customer *customer : nodes) {
+      customer->setLeft(nullptr);
+      customer->setRight(nullptr);
+    }
+    m_root = nullptr;
+  }
+  adopt(nodes);
+}
+
+void WirelessPower::contents(vector<Customer *> &nodes) const {
+  if (m_skip != nullptr) {
+    m_skip->collect(nodes);
+    return;
+  }
+  if (m_small != nullptr) {
+    m_small->collect(nodes);
+    return;
+  }
+  vector<Customer *> tree;
+  flatten(m_root, tree);
+  pendingNodes(tree); // pending ids are all larger
+  for (const Customer *customer : tree) {
+    nodes.push_back(new Customer(customer->getID(), customer->getLatitude(),
+                                 customer->getLongitude()));
+  }
+}
+
+bool WirelessPower::orderedNodes(vector<Customer *> &nodes) const {
+  if (m_skip != nullptr || m_small != nullptr) {
+    contents(nodes); // no tree nodes to point at
+    return true;
+  }
+  flatten(m_root, nodes);
+  pendingNodes(nodes); // pending ids are all larger
+  return false;
+}
+
+void WirelessPower::adopt(vector<Customer *> &nodes) {
+  if (m_skip != nullptr) {
+    m_skip->build(nodes);
+    for (Customer *customer : nodes) {
+      delete customer;
+    }
+    return;
+  }
+  if (m_small != nullptr && (int)nodes.size() <= SMALL_CUSTOMERS) {
+    for (Customer *customer : nodes) {
+      m_small->insert(customer->getID(), customer->getLatitude(),
+                      customer->getLongitude());
+      if (m_tiles != nullptr) {
+        m_tiles->add(customer->getLatitude(), customer->getLongitude(), 1);
+      }
+      delete customer;
+    }
+    return;
+  }
+  delete m_small; // too many for the array
+  m_small = nullptr;
+  m_root = buildBalanced(nodes, 0, (int)nodes.size() - 1);
+  if (m_type == REDBLACK) {
+    colorFromHeights(m_root, DEFAULT_HEIGHT - 1);
+  }
+  if (m_tiles != nullptr) { // not kept up to date while in a skip list
+    m_tiles->clear();
+    addTiles(m_root);
+  }
+}
+
+void WirelessPower::promote() {
+  vector<Customer *> nodes; // sorted, so the tree is built balanced
+  m_small->collect(nodes);
+  delete m_small;
+  m_small = nullptr;
+  m_root = buildBalanced(nodes, 0, (int)nodes.size() - 1);
+  if (m_type == REDBLACK) {
+    colorFromHeights(m_root, DEFAULT_HEIGHT - 1);
+  }
+}
+
+void WirelessPower::setSmall(bool small) {
+  if (!small && m_small != nullptr) {
+    promote();
+  } else if (small && m_small == nullptr && m_skip == nullptr) {
+    finishConversion();
+    vector<Customer *> nodes;
+    flatten(m_root, nodes);
+    if ((int)nodes.size() <= SMALL_CUSTOMERS) {
+      m_small = new SmallRegistry();
+      for (Customer *customer : nodes) {
+        m_small->insert(customer->getID(), customer->getLatitude(),
+                        customer->getLongitude());
+        freeNode(customer);
+      }
+      m_root = nullptr;
+      m_finger.clear();
+    }
+  }
+}
+
+bool WirelessPower::step(int budget) {
+  for (int i = 0; i < budget && isConverting(); i++) {
+    convertStep();
+  }
+  if (!isConverting()) {
+    m_oldSpine.clear();
+    m_newSpine.clear();
+    m_convertRemoved.clear(); // marks of ids that were never pending
+  }
+  return isConverting();
+}
+
+bool WirelessPower::isConverting() const {
+  return m_convertRoot != nullptr || m_convertAdded != nullptr;
+}
+
+void WirelessPower::attachLog(MutationLog *log) { m_log = log; }
+
+void WirelessPower::attachTrace(TraceRecorder *trace) {
+  m_trace = trace;
+  if (m_trace != nullptr) { // replay starts from an empty registry
+    m_trace->record(TRACE_SETTYPE, m_type);
+    if (m_splayPolicy != SPLAY_FULL) {
+      m_trace->record(TRACE_SETPOLICY, m_splayPolicy, m_splayParameter);
+    }
+    traceTree(m_root);
+    if (m_skip != nullptr || m_small != nullptr) {
+      vector<Customer *> nodes;
+      contents(nodes);
+      for (Customer *customer : nodes) {
+        traceTree(customer);
+        delete customer;
+      }
+    }
+    vector<Customer *> pending; // still linked, so one at a time
+    pendingNodes(pending);
+    for (const Customer *customer : pending) {
+      m_trace->record(TRACE_INSERT, customer->getID(), customer->getLatitude(),
+                      customer->getLongitude());
+    }
+    if (m_capacity > 0) { // after the inserts, they were within capacity
+      m_trace->record(TRACE_SETCAPACITY, m_capacity);
+    }
+  }
+}
+
+void WirelessPower::traceTree(const Customer *customer) {
+  if (customer != nullptr) {
+    traceTree(customer->getLeft());
+    m_trace->record(TRACE_INSERT, customer->getID(), customer->getLatitude(),
+                    customer->getLongitude());
+    traceTree(customer->getRight());
+  }
+}
+
+void WirelessPower::finishConversion() {
+  while (step(m_convertBudget)) {
+  }
+}
+
+void WirelessPower::convertStep() {
+  m_visits++;
+  // descend one node, the pending min is on top once it has no left child
+  if (m_convertRoot != nullptr &&
+      (m_oldSpine.empty() || m_oldSpine.back()->getLeft() != nullptr)) {
+    m_oldSpine.push_back(m_oldSpine.empty() ? m_convertRoot
+                                            : m_oldSpine.back()->getLeft());
+    return;
+  }
+  Customer *added = findMin(m_convertAdded);
+  Customer *min = m_oldSpine.empty() ? nullptr : m_oldSpine.back();
+  if (min == nullptr || (added != nullptr && added->getID() < min->getID())) {
+    m_convertAdded = removeMinAVL(m_convertAdded, added);
+    appendMax(added);
+    return;
+  }
+  m_oldSpine.pop_back();
+  Customer *right = min->getRight(); // the min never has a left child
+  if (m_oldSpine.empty()) {
+    m_convertRoot = right;
+  } else {
+    m_oldSpine.back()->setLeft(right);
+  }
+  min->setRight(nullptr);
+  if (removedPending(min->getID())) { // an added copy may take its place
+    m_convertRemoved[min->getID() - MINID] = false;
+    freeNode(min);
+    return;
+  }
+  if (added != nullptr && added->getID() == min->getID()) {
+    m_convertAdded = removeMinAVL(m_convertAdded, added);
+    freeNode(added); // inserting a present id keeps its location
+  }
+  updateHeight(min);
+  appendMax(min);
+}
+
+Customer *WirelessPower::removeMinAVL(Customer *root, Customer *&min) {
+  m_visits++;
+  if (root->getLeft() == nullptr) {
+    min = root;
+    Customer *right = root->getRight();
+    root->setRight(nullptr);
+    updateHeight(root);
+    return right;
+  }
+  root->setLeft(removeMinAVL(root->getLeft(), min));
+  updateHeight(root);
+  return balance(root);
+}
+
+bool WirelessPower::removedPending(int id) const {
+  return !m_convertRemoved.empty() && id >= MINID && id <= MAXID &&
+         m_convertRemoved[id - MINID];
+}
+
+void WirelessPower::pendingNodes(vector<Customer *> &nodes) const {
+  // a pending node is shadowed by its removal mark, and shadows an added
+  // customer with its id because that insert found the id present
+  vector<Customer *> pending;
+  vector<Customer *> added;
+  flatten(m_convertRoot, pending);
+  flatten(m_convertAdded, added);
+  size_t j = 0;
+  for (Customer *customer : pending) {
+    if (removedPending(customer->getID())) {
+      continue;
+    }
+    while (j < added.size() && added[j]->getID() < customer->getID()) {
+      nodes.push_back(added[j++]);
+    }
+    if (j < added.size() && added[j]->getID() == customer->getID()) {
+      j++;
+    }
+    nodes.push_back(customer);
+  }
+  nodes.insert(nodes.end(), added.begin() + j, added.end());
+}
+
+void WirelessPower::appendMax(Customer *customer) {
+  convertedMax(); // makes sure the right spine is up to date
+  if (m_root == nullptr) {
+    m_root = customer;
+    m_newSpine.push_back(customer);
+    return;
+  }
+  m_newSpine.back()->setRight(customer);
+  m_newSpine.push_back(customer);
+
+  // walk back up the right spine until a subtree height stops changing
+  for (int i = (int)m_newSpine.size() - 2; i >= 0; i--) {
+    m_visits++;
+    Customer *ancestor = m_newSpine[i];
+    int oldHeight = ancestor->getHeight();
+    updateHeight(ancestor);
+    Customer *top = balance(ancestor);
+    if (top != m_newSpine[i]) { // rotated, relink and redo the spine below
+      if (i == 0) {
+        m_root = top;
+      } else {
+        m_newSpine[i - 1]->setRight(top);
+      }
+      m_newSpine.resize(i);
+      for (Customer *temp = top; temp != nullptr; temp = temp->getRight()) {
+        m_newSpine.push_back(temp);
+      }
+    }
+    if (top->getHeight() == oldHeight && !m_hashing && !m_counting) {
+      break; // hashes and sizes change all the way up to the root
+    }
+  }
+}
+
+Customer *WirelessPower::convertedMax() {
+  if (m_newSpine.empty()) {
+    for (Customer *temp = m_root; temp != nullptr; temp = temp->getRight()) {
+      m_newSpine.push_back(temp);
+    }
+  }
+  return m_newSpine.empty() ? nullptr : m_newSpine.back();
+}
+
+void WirelessPower::insertConverting(const Customer &customer) {
+  Customer *max = convertedMax();
+  if (max != nullptr && customer.getID() <= max->getID()) {
+    m_root = insert<AVL>(m_root, customer);
+    m_newSpine.clear(); // rotations may have moved the right spine
+    return;
+  }
+  // a present pending id shadows this copy, convertStep() drops it
+  m_convertAdded = insert<AVL>(m_convertAdded, customer);
+}
+
+void WirelessPower::removeConverting(int id) {
+  Customer *max = convertedMax();
+  if (max != nullptr && id <= max->getID()) {
+    m_root = remove<AVL>(m_root, id);
+    m_root = balance(m_root);
+    m_newSpine.clear();
+    return;
+  }
+  m_convertAdded = remove<AVL>(m_convertAdded, id);
+  m_convertAdded = balance(m_convertAdded);
+  if (id >= MINID && id <= MAXID) { // convertStep() drops the pending node
+    if (m_convertRemoved.empty()) {
+      m_convertRemoved.assign(MAXID - MINID + 1, false);
+    }
+    m_convertRemoved[id - MINID] = true;
+  }
+}
+
+static unsigned long long mixHash(unsigned long long value) {
+  value += 0x9E3779B97F4A7C15ULL; // splitmix64 finalizer
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+void WirelessPower::setHashing(bool hashing) {
+  if (hashing && !m_hashing) {
+    m_hashing = true;
+    rehash(m_root); // pending customers are hashed as they move
+  }
+  m_hashing = hashing;
+}
+
+bool WirelessPower::hashesValid() const {
+  // the pending tree of a conversion does not keep its hashes up to date,
+  // the array of a small registry and the skip list keep none
+  return m_hashing && !isConverting() && m_small == nullptr &&
+         m_skip == nullptr;
+}
+
+unsigned long long WirelessPower::nodeHash(const Customer *customer) const {
+  unsigned long long latBits = 0;
+  unsigned long long longBits = 0;
+  double lat = customer->getLatitude();
+  double longitude = customer->getLongitude();
+  memcpy(&latBits, &lat, sizeof(lat));
+  memcpy(&longBits, &longitude, sizeof(longitude));
+  return mixHash(mixHash(mixHash(customer->getID()) ^ latBits) ^ longBits);
+}
+
+unsigned long long WirelessPower::getHash(const Customer *customer) const {
+  return (customer == nullptr) ? 0 : customer->getHash();
+}
+
+void WirelessPower::rehash(Customer *customer) {
+  if (customer != nullptr) {
+    rehash(customer->getLeft());
+    rehash(customer->getRight());
+    customer->m_hash = nodeHash(customer) + getHash(customer->getLeft()) +
+                       getHash(customer->getRight());
+  }
+}
+
+void WirelessPower::setCounting(bool counting) {
+  if (counting && !m_counting) {
+    m_counting = true;
+    resize(m_root);
+  }
+  m_counting = counting || m_capacity > 0; // a capacity needs the sizes
+}
+
+bool WirelessPower::compact(int budget) {
+  if (m_small != nullptr) {
+    return false; // already one block
+  }
+  finishConversion();
+  m_finger.clear(); // every node may move
+  if (budget <= 0 || getHeight(m_root) < 1) {
+    relayout(&m_root, DEFAULT_HEIGHT - 1);
+    m_compacting = false;
+    return false;
+  }
+  // a subtree no higher than stop has at most budget nodes
+  int stop = 0;
+  while ((2 << (stop + 1)) - 1 <= budget) {
+    stop++;
+  }
+  if (!m_compacting) {
+    m_compacting = true;
+    m_compactNext = LLONG_MIN;
+  }
+  Customer **chunk = findChunk(&m_root, m_compactNext, stop);
+  if (chunk == nullptr) { // every chunk moved, now the nodes above them
+    relayout(&m_root, stop);
+    m_compacting = false;
+    return false;
+  }
+  Customer *max = *chunk;
+  while (max->getRight() != nullptr) {
+    max = max->getRight();
+  }
+  m_compactNext = (long long)max->getID() + 1;
+  relayout(chunk, DEFAULT_HEIGHT - 1);
+  return true;
+}
+
+Customer **WirelessPower::findChunk(Customer **slot, long long next,
+                                    int stop) {
+  // the leftmost subtree no higher than stop holding an id from next up
+  Customer *customer = *slot;
+  if (customer == nullptr) {
+    return nullptr;
+  }
+  if (customer->getHeight() <= stop) {
+    Customer *max = customer;
+    while (max->getRight() != nullptr) {
+      max = max->getRight();
+    }
+    return (max->getID() >= next) ? slot : nullptr;
+  }
+  Customer **found = nullptr;
+  if (next < customer->getID()) {
+    found = findChunk(&customer->m_left, next, stop);
+  }
+  return (found != nullptr) ? found : findChunk(&customer->m_right, next, stop);
+}
+
+void WirelessPower::vebOrder(Customer *root, int levels, int stop,
+                             vector<Customer *> &order) {
+  // the top half of the levels first, then each subtree hanging below it
+  if (root == nullptr || root->getHeight() <= stop) {
+    return;
+  }
+  if (levels == 1) {
+    order.push_back(root);
+    return;
+  }
+  int top = levels / 2;
+  vebOrder(root, top, stop, order);
+  vector<Customer *> frontier;
+  atDepth(root, top, stop, frontier);
+  for (Customer *bottom : frontier) {
+    vebOrder(bottom, levels - top, stop, order);
+  }
+}
+
+void WirelessPower::atDepth(Customer *customer, int depth, int stop,
+                            vector<Customer *> &frontier) {
+  if (customer == nullptr || customer->getHeight() <= stop) {
+    return;
+  }
+  if (depth == 0) {
+    frontier.push_back(customer);
+  } else {
+    atDepth(customer->getLeft(), depth - 1, stop, frontier);
+    atDepth(customer->getRight(), depth - 1, stop, frontier);
+  }
+}
+
+void WirelessPower::relayout(Customer **slot, int stop) {
+  vector<Customer *> order;
+  vebOrder(*slot, getHeight(*slot) - stop, stop, order);
+  if (order.empty()) {
+    return;
+  }
+  Customer *block = allocateBlock(order.size());
+  unordered_map<Customer *, Customer *> moved(order.size() * 2);
+  for (int i = 0; i < (int)order.size(); i++) {
+    moved[order[i]] = new (block + i) Customer(*order[i]);
+  }
+  // links out of the region keep pointing at the nodes below it
+  for (int i = 0; i < (int)order.size(); i++) {
+    unordered_map<Customer *, Customer *>::iterator left =
+        moved.find(block[i].m_left);
+    unordered_map<Customer *, Customer *>::iterator right =
+        moved.find(block[i].m_right);
+    if (left != moved.end()) {
+      block[i].m_left = left->second;
+    }
+    if (right != moved.end()) {
+      block[i].m_right = right->second;
+    }
+  }
+  *slot = moved[*slot];
+  for (Customer *customer : order) {
+    freeNode(customer);
+  }
+}
+
+Customer *WirelessPower::allocateBlock(size_t count) {
+  Customer *block = (Customer *)::operator new(count * sizeof(Customer));
+  m_blocks[block] = NodeBlock{count, count};
+  return block;
+}
+
+void WirelessPower::freeNode(Customer *customer) {
+  if (!m_blocks.empty()) {
+    map<const Customer *, NodeBlock>::iterator block =
+        m_blocks.upper_bound(customer);
+    if (block != m_blocks.begin()) {
+      --block;
+      if (customer < block->first + block->second.m_count) {
+        customer->~Customer();
+        if (--block->second.m_live == 0) { // last node of the block
+          ::operator delete((void *)block->first);
+          m_blocks.erase(block);
+        }
+        return;
+      }
+    }
+  }
+  delete customer;
+}
+
+bool WirelessPower::touch(int id) {
+  if (m_skip != nullptr) {
+    return m_skip->contains(id);
+  }
+  ProfileScope scope(m_stats, OP_LOOKUP, m_type, id, m_visits, m_rotations);
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_LOOKUP, id);
+  }
+  if (m_small != nullptr) {
+    return m_small->find(id) >= 0;
+  }
+  const Customer *customer = findNode(id);
+  if (customer == nullptr) {
+    return false;
+  }
+  if (m_type == SPLAY && m_convertRoot == nullptr &&
+      m_splayPolicy != SPLAY_FULL) {
+    splayAccess(id);
+  } else if (m_type == SPLAY && m_convertRoot == nullptr) {
+    Customer copy(*customer); // inserting a present id only splays it
+    m_root = insert<SPLAY>(m_root, copy);
+  }
+  return true;
+}
+
+void WirelessPower::setSplayPolicy(SPLAYPOLICY policy, double parameter) {
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_SETPOLICY, policy, parameter);
+  }
+  m_splayPolicy = policy;
+  m_splayParameter = parameter;
+}
+
+void WirelessPower::splayAccess(int id) {
+  bool splays = false;
+  switch (m_splayPolicy) {
+  case SPLAY_FULL:
+    break;
+  case SPLAY_SEMI:
+    m_root = splayDown(m_root, id, true);
+    break;
+  case SPLAY_DEPTH: {
+    int depth = 0; // of id, or of the last node on its path on a miss
+    const Customer *customer = m_root;
+    while (customer != nullptr && customer->getID() != id) {
+      m_visits++;
+      customer = (id < customer->getID()) ? customer->getLeft()
+                                           : customer->getRight();
+      depth += (customer != nullptr) ? 1 : 0;
+    }
+    splays = depth > m_splayParameter;
+    break;
+  }
+  case SPLAY_RANDOM:
+    m_splayRandom ^= m_splayRandom << 13; // xorshift64
+    m_splayRandom ^= m_splayRandom >> 7;
+    m_splayRandom ^= m_splayRandom << 17;
+    splays = (m_splayRandom >> 11) * (1.0 / (1ULL << 53)) < m_splayParameter;
+    break;
+  }
+  if (splays) {
+    m_root = splayDown(m_root, id, false);
+  }
+}
+
+// Top-down splay: the path is consumed two nodes at a time and the nodes
+// left of id are linked into a left tree, the ones right of it into a right
+// tree, which become the children of id at the end. With semi, each pair
+// is instead rotated in place and the walk goes on below it: a zig-zig
+// lifts the child over node, a zig-zag lifts the grandchild over both. The
+// customers further down the path move up by one per step, so id ends at
+// about half its depth on a straight path and two thirds on a zig-zag one.
+Customer *WirelessPower::splayDown(Customer *root, int id, bool semi) {
+  if (root == nullptr) {
+    return root;
+  }
+  m_splayPath.clear(); // nodes whose subtrees change, parents before children
+  if (semi) {
+    Customer **slot = &root;
+    while (*slot != nullptr && (*slot)->getID() != id) {
+      m_visits++;
+      Customer *node = *slot;
+      bool left = id < node->getID();
+      Customer *child = left ? node->getLeft() : node->getRight();
+      if (child == nullptr || child->getID() == id) {
+        break;
+      }
+      bool leftAgain = id < child->getID();
+      Customer *grandchild = leftAgain ? child->getLeft() : child->getRight();
+      if (grandchild == nullptr) {
+        break;
+      }
+      if (left == leftAgain) { // zig zig, child takes the place of node
+        *slot = left ? rotateRight(node) : rotateLeft(node);
+        m_splayPath.push_back(*slot);
+        slot = left ? &(*slot)->m_left : &(*slot)->m_right;
+      } else { // zig zag, grandchild takes the place of node
+        *slot = left ? rotateLeftRight(node) : rotateRightLeft(node);
+        Customer *lifted = *slot;
+        m_splayPath.push_back(lifted);
+        m_splayPath.push_back(lifted->getLeft());
+        m_splayPath.push_back(lifted->getRight());
+        if (lifted->getID() == id) {
+          break;
+        }
+        // the rest of the path hangs off the inner side of a new child
+        slot = (id < lifted->getID()) ? &lifted->m_left->m_right
+                                      : &lifted->m_right->m_left;
+      }
+    }
+  } else {
+    Customer *leftHead = nullptr;
+    Customer *leftTail = nullptr;
+    Customer *rightHead = nullptr;
+    Customer *rightTail = nullptr;
+    while (true) {
+      m_visits++;
+      if (id < root->getID()) {
+        if (root->getLeft() == nullptr) {
+          break;
+        }
+        if (id < root->getLeft()->getID()) { // zig zig
+          rotateRight(root);
+          if (root->getLeft() == nullptr) {
+            break;
+          }
+        }
+        if (rightTail == nullptr) { // link right
+          rightHead = root;
+        } else {
+          rightTail->setLeft(root);
+        }
+        rightTail = root;
+        m_splayPath.push_back(root);
+        root = root->getLeft();
+      } else if (id > root->getID()) {
+        if (root->getRight() == nullptr) {
+          break;
+        }
+        if (id > root->getRight()->getID()) { // zag zag
+          rotateLeft(root);
+          if (root->getRight() == nullptr) {
+            break;
+          }
+        }
+        if (leftTail == nullptr) { // link left
+          leftHead = root;
+        } else {
+          leftTail->setRight(root);
+        }
+        leftTail = root;
+        m_splayPath.push_back(root);
+        root = root->getRight();
+      } else {
+        break;
+      }
+    }
+    if (leftTail != nullptr) { // reassemble
+      leftTail->setRight(root->getLeft());
+      root->setLeft(leftHead);
+    }
+    if (rightTail != nullptr) {
+      rightTail->setLeft(root->getRight());
+      root->setRight(rightHead);
+    }
+  }
+  for (int i = (int)m_splayPath.size() - 1; i >= 0; i--) {
+    updateHeight(m_splayPath[i]);
+  }
+  updateHeight(root);
+  return root;
+}
+
+void WirelessPower::setCapacity(int customers) {
+  m_capacity = max(0, customers);
+  if (m_trace != nullptr) {
+    m_trace->record(TRACE_SETCAPACITY, m_capacity);
+  }
+  if (m_capacity > 0) {
+    setCounting(true);
+    if (m_type == SPLAY && m_convertRoot == nullptr &&
+        getSize(m_root) > m_capacity) {
+      evict();
+    }
+  }
+}
+
+void WirelessPower::evict() {
+  // customers per depth, recently splayed customers sit near the root
+  vector<int> levels;
+  countDepths(m_root, 0, levels);
+  int kept = 0;
+  int depth = 0;
+  while (kept + levels[depth] < m_capacity) {
+    kept += levels[depth];
+    depth++;
+  }
+  int keepAtDepth = m_capacity - kept;
+  // a replay evicts the same customers from its capacity record, so only
+  // the log sees these removes
+  TraceRecorder *trace = m_trace;
+  m_trace = nullptr;
+  m_root = prune(m_root, 0, depth, keepAtDepth);
+  m_trace = trace;
+}
+
+void WirelessPower::countDepths(const Customer *customer, int depth,
+                                vector<int> &levels) const {
+  if (customer != nullptr) {
+    if (depth == (int)levels.size()) {
+      levels.push_back(0);
+    }
+    levels[depth]++;
+    countDepths(customer->getLeft(), depth + 1, levels);
+    countDepths(customer->getRight(), depth + 1, levels);
+  }
+}
+
+Customer *WirelessPower::prune(Customer *customer, int depth, int maxDepth,
+                               int &keepAtMax) {
+  // everything below maxDepth goes, and every node at maxDepth past the
+  // first keepAtMax of them, the kept nodes still form one subtree
+  if (customer == nullptr) {
+    return nullptr;
+  }
+  if (depth == maxDepth) {
+    discard(customer->getLeft());
+    discard(customer->getRight());
+    customer->setLeft(nullptr);
+    customer->setRight(nullptr);
+    if (keepAtMax == 0) {
+      discard(customer);
+      return nullptr;
+    }
+    keepAtMax--;
+  } else {
+    customer->setLeft(prune(customer->getLeft(), depth + 1, maxDepth,
+                            keepAtMax));
+    customer->setRight(prune(customer->getRight(), depth + 1, maxDepth,
+                             keepAtMax));
+  }
+  updateHeight(customer);
+  return customer;
+}
+
+int WirelessPower::getSize(const Customer *customer) const {
+  return (customer == nullptr) ? 0 : customer->getSize();
+}
+
+void WirelessPower::resize(Customer *customer) {
+  if (customer != nullptr) {
+    resize(customer->getLeft());
+    resize(customer->getRight());
+    customer->m_size =
+        1 + getSize(customer->getLeft()) + getSize(customer->getRight());
+  }
+}
+
+int WirelessPower::rank(int id) const {
+  if (m_small != nullptr) {
+    return m_small->lowerBound(id);
+  }
+  // the pending customers of a conversion are not sized, their ids are all
+  // larger
+  return countBelow(m_root, id, m_counting) + countPending(id);
+}
+
+int WirelessPower::select(int k) const {
+  if (k < 0) {
+    return DEFAULT_ID;
+  }
+  if (m_small != nullptr) {
+    return (k < m_small->size()) ? m_small->getID(k) : DEFAULT_ID;
+  }
+  const Customer *found = selectNode(m_root, k, m_counting);
+  if (found == nullptr && isConverting()) {
+    vector<Customer *> pending;
+    pendingNodes(pending);
+    found = (k < (int)pending.size()) ? pending[k] : nullptr;
+  }
+  return (found == nullptr) ? DEFAULT_ID : found->getID();
+}
+
+int WirelessPower::countRange(int low, int high) const {
+  if (low > high) {
+    return 0;
+  }
+  if (m_skip != nullptr) {
+    return m_skip->countRange(low, high);
+  }
+  if (m_small != nullptr) {
+    return m_small->lowerBound((long long)high + 1) - m_small->lowerBound(low);
+  }
+  long long above = (long long)high + 1;
+  return countBelow(m_root, above, m_counting) + countPending(above) -
+         rank(low);
+}
+
+int WirelessPower::height() const {
+  return (m_root == nullptr) ? -1 : m_root->getHeight();
+}
+
+void WirelessPower::searchPath(int id, vector<const Customer *> &path) const {
+  for (const Customer *customer = m_root; customer != nullptr;) {
+    path.push_back(customer);
+    if (id == customer->getID()) {
+      break;
+    }
+    customer =
+        (id < customer->getID()) ? customer->getLeft() : customer->getRight();
+  }
+}
+
+int WirelessPower::rotations() const { return m_rotations; }
+
+int WirelessPower::countPending(long long id) const {
+  if (!isConverting()) {
+    return 0;
+  }
+  vector<Customer *> pending;
+  pendingNodes(pending);
+  return lower_bound(pending.begin(), pending.end(), id,
+                     [](const Customer *customer, long long id) {
+                       return customer->getID() < id;
+                     }) -
+         pending.begin();
+}
+
+int WirelessPower::countBelow(const Customer *customer, long long id,
+                              bool sized) const {
+  int count = 0;
+  while (customer != nullptr) {
+    if (customer->getID() < id) { // the whole left subtree is below id
+      count += 1 + (sized ? getSize(customer->getLeft())
+                          : countBelow(customer->getLeft(), LLONG_MAX, false));
+      customer = customer->getRight();
+    } else {
+      customer = customer->getLeft();
+    }
+  }
+  return count;
+}
+
+const Customer *WirelessPower::selectNode(const Customer *customer, int &k,
+                                          bool sized) const {
+  // on a miss k is reduced by the size of the subtree
+  if (sized) {
+    while (customer != nullptr) {
+      int leftSize = getSize(customer->getLeft());
+      if (k < leftSize) {
+        customer = customer->getLeft();
+      } else if (k == leftSize) {
+        return customer;
+      } else {
+        k -= leftSize + 1;
+        customer = customer->getRight();
+      }
+    }
+    return nullptr;
+  }
+  if (customer == nullptr) {
+    return nullptr;
+  }
+  const Customer *found = selectNode(customer->getLeft(), k, false);
+  if (found != nullptr) {
+    return found;
+  }
+  if (k == 0) {
+    return customer;
+  }
+  k--;
+  return selectNode(customer->getRight(), k, false);
+}
+
+unsigned long long WirelessPower::hashBelow(const Customer *customer,
+                                            long long id) const {
+  // sum of the hashes of every node with an id smaller than id
+  unsigned long long sum = 0;
+  while (customer != nullptr) {
+    if (customer->getID() < id) {
+      sum += nodeHash(customer) + getHash(customer->getLeft());
+      customer = customer->getRight();
+    } else {
+      customer = customer->getLeft();
+    }
+  }
+  return sum;
+}
+
+unsigned long long WirelessPower::rangeHash(long long low,
+                                            long long high) const {
+  return hashBelow(m_root, high + 1) - hashBelow(m_root, low);
+}
+
+const Customer *WirelessPower::findNode(int id) const {
+  // a removed pending node is skipped, an added customer shadowed by a
+  // pending one is never reached
+  const Customer *roots[] = {m_root, m_convertRoot, m_convertAdded};
+  for (int i = 0; i < 3; i++) {
+    const Customer *customer = roots[i];
+    while (customer != nullptr && id != customer->getID()) {
+      customer = (id < customer->getID()) ? customer->getLeft()
+                                          : customer->getRight();
+    }
+    if (customer != nullptr && (i != 1 || !removedPending(id))) {
+      return customer;
+    }
+  }
+  return nullptr;
+}
+
+void WirelessPower::diff(const WirelessPower &other,
+                         vector<CustomerDelta> &delta) const {
+  if (hashesValid() && other.hashesValid()) {
+    const Customer *mine = findMin(m_root);
+    const Customer *theirs = other.findMin(other.m_root);
+    if (mine == nullptr && theirs == nullptr) {
+      return;
+    }
+    long long low = (mine == nullptr) ? theirs->getID()
+                    : (theirs == nullptr)
+                        ? mine->getID()
+                        : min(mine->getID(), theirs->getID());
+    long long high = low;
+    for (const Customer *temp = m_root; temp != nullptr;
+         temp = temp->getRight()) {
+      high = max(high, (long long)temp->getID());
+    }
+    for (const Customer *temp = other.m_root; temp != nullptr;
+         temp = temp->getRight()) {
+      high = max(high, (long long)temp->getID());
+    }
+    diffRange(other, low, high, delta);
+    return;
+  }
+  // without hashes merge both in-order sequences
+  vector<Customer *> mine;
+  vector<Customer *> theirs;
+  bool mineCopied = orderedNodes(mine);
+  bool theirsCopied = other.orderedNodes(theirs);
+  size_t i = 0;
+  size_t j = 0;
+  while (i < mine.size() || j < theirs.size()) {
+    if (j == theirs.size() ||
+        (i < mine.size() && mine[i]->getID() < theirs[j]->getID())) {
+      diffNodes(mine[i++], nullptr, delta);
+    } else if (i == mine.size() || theirs[j]->getID() < mine[i]->getID()) {
+      diffNodes(nullptr, theirs[j++], delta);
+    } else {
+      diffNodes(mine[i++], theirs[j++], delta);
+    }
+  }
+  for (int k = 0; mineCopied && k < (int)mine.size(); k++) {
+    delete mine[k];
+  }
+  for (int k = 0; theirsCopied && k < (int)theirs.size(); k++) {
+    delete theirs[k];
+  }
+}
+
+void WirelessPower::diffRange(const WirelessPower &other, long long low,
+                              long long high,
+                              vector<CustomerDelta> &delta) const {
+  // equal hashes mean equal contents, the whole id range is skipped
+  if (rangeHash(low, high) == other.rangeHash(low, high)) {
+    return;
+  }
+  if (low == high) {
+    diffNodes(findNode((int)low), other.findNode((int)low), delta);
+    return;
+  }
+  long long mid = low + (high - low) / 2;
+  diffRange(other, low, mid, delta);
+  diffRange(other, mid + 1, high, delta);
+}
+
+void WirelessPower::diffNodes(const Customer *mine, const Customer *theirs,
+                              vector<CustomerDelta> &delta) const {
+  if (mine != nullptr && theirs == nullptr) {
+    delta.push_back(CustomerDelta{DELTA_REMOVE, mine->getID(), 0, 0});
+  } else if (mine == nullptr && theirs != nullptr) {
+    delta.push_back(CustomerDelta{DELTA_INSERT, theirs->getID(),
+                                  theirs->getLatitude(),
+                                  theirs->getLongitude()});
+  } else if (mine != nullptr &&
+             (mine->getLatitude() != theirs->getLatitude() ||
+              mine->getLongitude() != theirs->getLongitude())) {
+    delta.push_back(CustomerDelta{DELTA_UPDATE, theirs->getID(),
+                                  theirs->getLatitude(),
+                                  theirs->getLongitude()});
+  }
+}
+
+void WirelessPower::setTiling(int levels) {
+  delete m_tiles;
+  m_tiles = nullptr;
+  if (levels > 0) {
+    m_tiles = new TileCounts(levels);
+    addTiles(m_root);
+    vector<Customer *> pending;
+    pendingNodes(pending);
+    for (const Customer *customer : pending) {
+      m_tiles->add(customer->getLatitude(), customer->getLongitude(), 1);
+    }
+    for (int i = 0; m_small != nullptr && i < m_small->size(); i++) {
+      m_tiles->add(m_small->getLatitude(i), m_small->getLongitude(i), 1);
+    }
+  }
+}
+
+const TileCounts *WirelessPower::getTiles() const { return m_tiles; }
+
+void WirelessPower::setMetering(bool metering) {
+  if (metering && m_meters.empty()) {
+    m_meters.assign(MAXID - MINID + 1, nullptr);
+  } else if (!metering) {
+    for (MeterSeries *series : m_meters) {
+      delete series;
+    }
+    m_meters.clear();
+  }
+}
+
+bool WirelessPower::addReading(int id, long long time, double watts) {
+  if (m_meters.empty() || m_skip != nullptr || !find(id)) {
+    return false;
+  }
+  MeterSeries *&series = m_meters[id - MINID];
+  if (series == nullptr) {
+    series = new MeterSeries();
+  }
+  return series->append(time, watts);
+}
+
+void WirelessPower::dropReadings(int id) {
+  if (!m_meters.empty() && id >= MINID && id <= MAXID) {
+    delete m_meters[id - MINID];
+    m_meters[id - MINID] = nullptr;
+  }
+}
+
+MeterAggregate WirelessPower::aggregate(int id, long long from,
+                                        long long to) const {
+  if (m_meters.empty() || id < MINID || id > MAXID ||
+      m_meters[id - MINID] == nullptr) {
+    return MeterAggregate();
+  }
+  return m_meters[id - MINID]->aggregate(from, to);
+}
+
+size_t WirelessPower::meterBytes(int id) const {
+  if (m_meters.empty() || id < MINID || id > MAXID ||
+      m_meters[id - MINID] == nullptr) {
+    return 0;
+  }
+  return m_meters[id - MINID]->bytes();
+}
+
+MeterAggregate WirelessPower::aggregateRange(int low, int high,
+                                             long long from, long long to,
+                                             int threads) const {
+  vector<MeterAggregate> buckets;
+  scan(low, high, from, to, 0, buckets, threads);
+  return buckets[0];
+}
+
+void WirelessPower::rollup(long long from, long long to, long long width,
+                           vector<MeterAggregate> &buckets,
+                           int threads) const {
+  scan(MINID, MAXID, from, to, max(1LL, width), buckets, threads);
+}
+
+void WirelessPower::scan(int low, int high, long long from, long long to,
+                         long long width, vector<MeterAggregate> &buckets,
+                         int threads) const {
+  long long count = 1;
+  if (width > 0 && to > from) {
+    count = (to - from - 1) / width + 1;
+  }
+  buckets.assign(count, MeterAggregate());
+  vector<const MeterSeries *> series;
+  if (!m_meters.empty() && to > from) {
+    metered(m_root, low, high, series);
+    vector<Customer *> pending;
+    pendingNodes(pending);
+    for (const Customer *customer : pending) {
+      int id = customer->getID();
+      if (id >= low && id <= high && m_meters[id - MINID] != nullptr) {
+        series.push_back(m_meters[id - MINID]);
+      }
+    }
+    for (int i = 0; m_small != nullptr && i < m_small->size(); i++) {
+      int id = m_small->getID(i);
+      if (id >= low && id <= high && m_meters[id - MINID] != nullptr) {
+        series.push_back(m_meters[id - MINID]);
+      }
+    }
+  }
+  // each thread takes every threads-th customer and fills its own buckets
+  int parts = max(1, min(threads, (int)series.size()));
+  vector<vector<MeterAggregate>> partial(parts, buckets);
+  auto scanPart = [&](int part) {
+    for (int i = part; i < (int)series.size(); i += parts) {
+      if (width == 0) {
+        partial[part][0].merge(series[i]->aggregate(from, to));
+      } else {
+        series[i]->rollup(from, to, width, partial[part]);
+      }
+    }
+  };
+  vector<future<void>> workers;
+  for (int part = 1; part < parts; part++) {
+    workers.push_back(async(launch::async, scanPart, part));
+  }
+  scanPart(0);
+  for (int part = 0; part < parts; part++) {
+    if (part > 0) {
+      workers[part - 1].get();
+    }
+    for (int i = 0; i < (int)count; i++) {
+      buckets[i].merge(partial[part][i]);
+    }
+  }
+}
+
+void WirelessPower::metered(const Customer *customer, int low, int high,
+                            vector<const MeterSeries *> &series) const {
+  // in id order, skipping subtrees outside [low, high]
+  if (customer != nullptr) {
+    if (customer->getID() > low) {
+      metered(customer->getLeft(), low, high, series);
+    }
+    int id = customer->getID();
+    if (id >= low && id <= high && m_meters[id - MINID] != nullptr) {
+      series.push_back(m_meters[id - MINID]);
+    }
+    if (customer->getID() < high) {
+      metered(customer->getRight(), low, high, series);
+    }
+  }
+}
+
+void WirelessPower::setProfiling(bool profiling, long long slowNanos) {
+  delete m_stats;
+  m_stats = profiling ? new LatencyStats(slowNanos) : nullptr;
+}
+
+const LatencyStats *WirelessPower::getStats() const { return m_stats; }
+
+void WirelessPower::addTiles(const Customer *customer) {
+  if (m_tiles != nullptr && customer != nullptr) {
+    m_tiles->add(customer->getLatitude(), customer->getLongitude(), 1);
+    addTiles(customer->getLeft());
+    addTiles(customer->getRight());
+  }
+}
+
+bool WirelessPower::updateLocation(int id, double lat, double longitude) {
+  if (m_small != nullptr) {
+    int index = m_small->find(id);
+    if (index < 0) {
+      return false;
+    }
+    if (m_log != nullptr) {
+      m_log->logRemove(id);
+      m_log->logInsert(Customer(id, lat, longitude));
+    }
+    if (m_tiles != nullptr) {
+      m_tiles->add(m_small->getLatitude(index), m_small->getLongitude(index),
+                   -1);
+      m_tiles->add(lat, longitude, 1);
+    }
+    m_small->setLocation(index, lat, longitude);
+    return true;
+  }
+  const Customer *customer = findNode(id);
+  if (customer == nullptr) {
+    return false;
+  }
+  if (m_log != nullptr) { // replays as a move
+    m_log->logRemove(id);
+    m_log->logInsert(Customer(id, lat, longitude));
+  }
+  if (m_tiles != nullptr) {
+    m_tiles->add(customer->getLatitude(), customer->getLongitude(), -1);
+    m_tiles->add(lat, longitude, 1);
+  }
+  // the same precedence as findNode()
+  return updateLocation(m_root, id, lat, longitude) ||
+         (!removedPending(id) &&
+          updateLocation(m_convertRoot, id, lat, longitude)) ||
+         updateLocation(m_convertAdded, id, lat, longitude);
+}
+
+bool WirelessPower::updateLocation(Customer *customer, int id, double lat,
+                                   double longitude) {
+  if (customer == nullptr) {
+    return false;
+  }
+  bool found = true;
+  if (id == customer->getID()) {
+    customer->setLatitude(lat);
+    customer->setLongitude(longitude);
+  } else if (id < customer->getID()) {
+    found = updateLocation(customer->getLeft(), id, lat, longitude);
+  } else {
+    found = updateLocation(customer->getRight(), id, lat, longitude);
+  }
+  if (found) {
+    updateHeight(customer); // refreshes the subtree hashes on the path
+  }
+  return found;
+}
+
+bool WirelessPower::verify(int threads) const {
+  int parallelDepth = 0;
+  while ((1 << parallelDepth) < threads) {
+    parallelDepth++;
+  }
+  if (m_type == REDBLACK && isRed(m_root)) {
+    return false;
+  }
+  if (m_skip != nullptr) {
+    return m_root == nullptr && m_skip->verify();
+  }
+  if (m_small != nullptr) {
+    return m_root == nullptr && !isConverting() && m_small->verify();
+  }
+  const Customer *max = m_root;
+  while (max != nullptr && max->getRight() != nullptr) {
+    max = max->getRight();
+  }
+  // every pending id of a conversion is above the converted ones
+  long long pendingLow = (max == nullptr) ? LLONG_MIN : max->getID();
+  return verify(m_root, LLONG_MIN, LLONG_MAX, false, parallelDepth).m_valid &&
+         verify(m_convertRoot, pendingLow, LLONG_MAX, true, parallelDepth)
+             .m_valid &&
+         verify(m_convertAdded, pendingLow, LLONG_MAX, false, parallelDepth)
+             .m_valid;
+}
+
+WirelessPower::SubtreeCheck
+WirelessPower::verify(const Customer *customer, long long low, long long high,
+                      bool pending, int parallelDepth) const {
+  SubtreeCheck result = {true, -1, 0};
+  if (customer == nullptr) {
+    return result;
+  }
+  int id = customer->getID();
+  if (id <= low || id >= high || id < MINID || id > MAXID) {
+    result.m_valid = false;
+    return result;
+  }
+  SubtreeCheck left;
+  SubtreeCheck right;
+  if (parallelDepth > 0) { // the left subtree runs on its own thread
+    future<SubtreeCheck> leftCheck = async(launch::async, [&]() {
+      return verify(customer->getLeft(), low, id, pending, parallelDepth - 1);
+    });
+    right = verify(customer->getRight(), id, high, pending, parallelDepth - 1);
+    left = leftCheck.get();
+  } else {
+    left = verify(customer->getLeft(), low, id, pending, 0);
+    if (!left.m_valid) {
+      return left;
+    }
+    right = verify(customer->getRight(), id, high, pending, 0);
+  }
+  result.m_valid = left.m_valid && right.m_valid;
+  result.m_height = 1 + max(left.m_height, right.m_height);
+  if (!result.m_valid || pending) {
+    return result; // pending nodes are a plain BST with stale heights
+  }
+  result.m_valid = customer->getHeight() == result.m_height;
+  if (m_type == AVL && abs(left.m_height - right.m_height) > 1) {
+    result.m_valid = false;
+  }
+  if (m_type == REDBLACK) {
+    if (left.m_blackHeight != right.m_blackHeight ||
+        (customer->isRed() &&
+         (isRed(customer->getLeft()) || isRed(customer->getRight())))) {
+      result.m_valid = false;
+    }
+    result.m_blackHeight = left.m_blackHeight + (customer->isRed() ? 0 : 1);
+  }
+  if (hashesValid()) {
+    unsigned long long expected = nodeHash(customer) +
+                                  getHash(customer->getLeft()) +
+                                  getHash(customer->getRight());
+    result.m_valid = result.m_valid && customer->getHash() == expected;
+  }
+  if (m_counting && customer->getSize() != 1 + getSize(customer->getLeft()) +
+                                               getSize(customer->getRight())) {
+    result.m_valid = false;
+  }
+  return result;
+}
+
+bool WirelessPower::verifySample(int paths, unsigned int seed) const {
+  if (m_small != nullptr) {
+    return verify(); // as cheap as one path
+  }
+  mt19937 generator(seed);
+  for (int i = 0; i < paths; i++) {
+    long long low = LLONG_MIN;
+    long long high = LLONG_MAX;
+    const Customer *customer = m_root;
+    while (customer != nullptr) {
+      if (!verifyNode(customer, low, high)) {
+        return false;
+      }
+      const Customer *left = customer->getLeft();
+      const Customer *right = customer->getRight();
+      if (left != nullptr && (right == nullptr || generator() % 2 == 0)) {
+        high = customer->getID();
+        customer = left;
+      } else {
+        low = customer->getID();
+        customer = right;
+      }
+    }
+  }
+  return true;
+}
+
+bool WirelessPower::verifyNode(const Customer *customer, long long low,
+                               long long high) const {
+  // only what can be checked from the node and its children
+  int id = customer->getID();
+  if (id <= low || id >= high || id < MINID || id > MAXID) {
+    return false;
+  }
+  int leftHeight = getHeight(customer->getLeft());
+  int rightHeight = getHeight(customer->getRight());
+  if (customer->getHeight() != 1 + max(leftHeight, rightHeight)) {
+    return false;
+  }
+  if (m_type == AVL && abs(leftHeight - rightHeight) > 1) {
+    return false;
+  }
+  if (m_type == REDBLACK && customer->isRed() &&
+      (isRed(customer->getLeft()) || isRed(customer->getRight()))) {
+    return false;
+  }
+  if (hashesValid()) {
+    unsigned long long expected = nodeHash(customer) +
+                                  getHash(customer->getLeft()) +
+                                  getHash(customer->getRight());
+    if (customer->getHash() != expected) {
+      return false;
+    }
+  }
+  return !m_counting ||
+         customer->getSize() ==
+             1 + getSize(customer->getLeft()) + getSize(customer->getRight());
+}
+
+bool WirelessPower::operator==(const WirelessPower &rhs) const {
+  // equal contents hash equally whatever the shape, so two hashed trees
+  // compare their root hashes and only a 64-bit collision says equal wrongly
+  if (hashesValid() && rhs.hashesValid()) {
+    return getHash(m_root) == rhs.getHash(rhs.m_root);
+  }
+  vector<Customer *> mine;
+  vector<Customer *> theirs;
+  bool mineCopied = orderedNodes(mine);
+  bool theirsCopied = rhs.orderedNodes(theirs);
+  bool equal = mine.size() == theirs.size();
+  for (int i = 0; equal && i < (int)mine.size(); i++) {
+    equal = mine[i]->getID() == theirs[i]->getID() &&
+            mine[i]->getLatitude() == theirs[i]->getLatitude() &&
+            mine[i]->getLongitude() == theirs[i]->getLongitude();
+  }
+  for (int i = 0; mineCopied && i < (int)mine.size(); i++) {
+    delete mine[i];
+  }
+  for (int i = 0; theirsCopied && i < (int)theirs.size(); i++) {
+    delete theirs[i];
+  }
+  return equal;
+}
+
+const WirelessPower &WirelessPower::operator=(const WirelessPower &rhs) {
+  if (!(*this == rhs)) {
+    clear();
+    if (m_skip != nullptr || rhs.m_skip != nullptr || m_small != nullptr ||
+        rhs.m_small != nullptr || rhs.isConverting()) {
+      vector<Customer *> nodes;
+      rhs.contents(nodes);
+      adopt(nodes);
+      return *this;
+    }
+    if (rhs.m_root == nullptr) {
+      return *this;
+    }
+    Customer *rhsRoot = rhs.m_root;
+    m_root = copyTree(rhsRoot);
+    if (m_hashing) { // rhs may not have kept its hashes
+      rehash(m_root);
+    }
+    if (m_counting) { // or its sizes
+      resize(m_root);
+    }
+    addTiles(m_root);
+  }
+  return *this;
+}
+
+Customer *WirelessPower::copyTree(Customer *&root) {
+  Customer *newNode = nullptr;
+  if (root != nullptr) {
+    newNode = new Customer(*root);
+
+    Customer *leftChild = root->getLeft();
+    Customer *rightChild = root->getRight();
+    newNode->setLeft(copyTree(leftChild));
+    newNode->setRight(copyTree(rightChild));
+
+    return newNode;
+  }
+  return newNode;
+}
+
+void WirelessPower::dumpTree() const {
+  if (m_skip != nullptr) {
+    m_skip->dump();
+  }
+  for (int i = 0; m_small != nullptr && i < m_small->size(); i++) {
+    cout << "(" << m_small->getID(i) << ")"; // no heights in the array
+  }
+  dump(m_root);
+  vector<Customer *> pending; // ids are all larger, order is kept
+  pendingNodes(pending);
+  for (const Customer *customer : pending) {
+    cout << "(" << customer->getID() << ")"; // heights are not kept yet
+  }
+}
+
+void WirelessPower::dump(Customer *customer) const {
+  if (customer != nullptr) {
+    cout << "(";
+    dump(customer->m_left); // first visit the left child
+    cout << customer->m_id << ":"
+         << customer->m_height; // second visit the node itself
+    dump(customer->m_right);    // third visit the right child
+    cout << ")";
+  }
+}
+
+ostream &operator<<(ostream &sout, const Customer &x) {
+  sout << x.m_id << " (" << x.getLatStr() << ", " << x.getLongStr() << ")"
+       << endl;
+  ;
+  return sout;
+}
+
+void WirelessPower::print2D(Customer *customer, int space) {
+  if (customer == nullptr) {
+    return;
+  }
+  space += SPACE;
+  print2D(customer->getRight(), space);
+  cout << endl;
+  for (int i = SPACE; i < space; i++) {
+    cout << " ";
+  }
+  cout << customer->getID() << ":" << customer->getHeight() << endl;
+  print2D(customer->getLeft(), space);
+}
+
+Customer *WirelessPower::getRoot() { return m_root; }
+
+bool WirelessPower::checkPreservance() const {
+  bool isPreserved = true;
+  if (m_root != nullptr) {
+    isPreserved = checkPreservance(m_root);
+  }
+  return isPreserved;
+}
+
+bool WirelessPower::checkPreservance(const Customer *customer) const {
   if (customer == nullptr) {
     return true;
   }
@@ -470,12 +2807,20 @@ bool WirelessPower::checkPreservance(const Customer *customer) const {
          checkPreservance(customer->getRight());
 }
 
-bool WirelessPower::isEmpty() const { return m_root == nullptr; }
+bool WirelessPower::isEmpty() const {
+  vector<Customer *> pending;
+  pendingNodes(pending); // every pending node may be marked removed
+  return m_root == nullptr && pending.empty() &&
+         (m_skip == nullptr || m_skip->size() == 0) &&
+         (m_small == nullptr || m_small->size() == 0);
+}
 
 bool WirelessPower::find(int id) const {
   bool pass = false;
-  if (m_root != nullptr && id >= MINID && id <= MAXID) {
-    pass = find(id, m_root);
+  if (id >= MINID && id <= MAXID) {
+    pass = findNode(id) != nullptr ||
+           (m_skip != nullptr && m_skip->contains(id)) ||
+           (m_small != nullptr && m_small->find(id) >= 0);
   }
   return pass;
 }
@@ -532,3 +2877,37 @@ bool WirelessPower::checkHeight(Customer *&root) const {
 
   return pass;
 }
+
+bool WirelessPower::checkRedBlack() const {
+  if (isRed(m_root)) {
+    return false;
+  }
+  return checkRedBlack(m_root) != -1;
+}
+
+int WirelessPower::checkRedBlack(const Customer *customer) const {
+  if (customer == nullptr) {
+    return 0; // null leaves count as black
+  }
+  if (customer->isRed() &&
+      (isRed(customer->getLeft()) || isRed(customer->getRight()))) {
+    return -1; // two reds in a row
+  }
+  int leftBlack = checkRedBlack(customer->getLeft());
+  int rightBlack = checkRedBlack(customer->getRight());
+  if (leftBlack == -1 || rightBlack == -1 || leftBlack != rightBlack) {
+    return -1;
+  }
+  return leftBlack + (customer->isRed() ? 0 : 1);
+}
+
+bool WirelessPower::checkHashes(const Customer *customer) const {
+  if (customer == nullptr) {
+    return true;
+  }
+  unsigned long long expected = nodeHash(customer) +
+                                getHash(customer->getLeft()) +
+                                getHash(customer->getRight());
+  return customer->getHash() == expected &&
+         checkHashes(customer->getLeft()) && checkHashes(customer->getRight());
+}
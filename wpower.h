@@ -1,11 +1,22 @@
 #ifndef WPOWER_H
 #define WPOWER_H
 #include <iostream>
+#include <map>
+#include <vector>
 using namespace std;
 
 class Grader;
 class Tester;
 class WirelessPower;
+class MutationLog;
+class CombiningWirelessPower;
+class TileCounts;
+class TraceRecorder;
+class LatencyStats;
+class LockFreeSkipList;
+class MeterSeries;
+class SmallRegistry;
+class SharedRegistry;
 
 const int MINID = 10000;
 const int MAXID = 99999;
@@ -17,7 +28,14 @@ const int MAXLONG = 180;
 #define DEFAULT_HEIGHT 0
 #define DEFAULT_ID 0
 
-enum TREETYPE { BST, AVL, SPLAY };
+// SKIPLIST keeps the customers in a LockFreeSkipList instead of a tree, so
+// insert, remove and touch may be called from many threads at once. Those
+// three only write the log, while a log is attached (or readings are kept)
+// insert and remove take the list's lock striped by id, so calls on one id
+// reach the log in the order they reach the list. The trace, tiles,
+// profiling, metering and everything that walks the tree (rank, select,
+// diff, compact, updateLocation) apply to the tree types only.
+enum TREETYPE { BST, AVL, SPLAY, REDBLACK, SKIPLIST };
 
 class Customer {
 public:
@@ -32,12 +50,17 @@ public:
     m_left = nullptr;
     m_right = nullptr;
     m_height = DEFAULT_HEIGHT;
+    m_red = false;
+    m_hash = 0;
+    m_size = 1;
   }
-
   int getHeight() const { return m_height; }
   Customer *getLeft() const { return m_left; }
   Customer *getRight() const { return m_right; }
   int getID() const { return m_id; }
+  bool isRed() const { return m_red; }
+  unsigned long long getHash() const { return m_hash; }
+  int getSize() const { return m_size; }
   double getLatitude() const { return m_latitude; }
   double getLongitude() const { return m_longitude; }
   void setID(const int id) { m_id = id; }
@@ -46,6 +69,7 @@ public:
   void setHeight(int height) { m_height = height; }
   void setLeft(Customer *left) { m_left = left; }
   void setRight(Customer *right) { m_right = right; }
+  void setRed(bool red) { m_red = red; }
   string getLatStr() const {
     string text = "";
     int latSeconds = (int)(abs(m_latitude * 3600));
@@ -79,12 +103,59 @@ private:
   Customer *m_left;
   Customer *m_right;
   int m_height;
+  bool m_red; // node color, only used by REDBLACK trees
+  // sum of the (id, lat, long) hashes of this subtree, kept up to date only
+  // while hashing is turned on
+  unsigned long long m_hash;
+  // customers in this subtree, kept up to date only while counting is on
+  int m_size;
+};
+
+// how a SPLAY tree restructures on insert and touch. SPLAY_FULL splays the
+// customer to the root. The others share one top-down pass: SPLAY_SEMI
+// rotates each pair of the path in place so it only shrinks, SPLAY_DEPTH splays
+// only when the customer is deeper than a threshold and SPLAY_RANDOM splays
+// with a probability.
+enum SPLAYPOLICY { SPLAY_FULL, SPLAY_SEMI, SPLAY_DEPTH, SPLAY_RANDOM };
+
+enum DELTATYPE { DELTA_INSERT, DELTA_REMOVE, DELTA_UPDATE };
+
+// one change needed to turn one registry into another
+struct CustomerDelta {
+  DELTATYPE m_type;
+  int m_id;
+  double m_latitude; // new coordinates for DELTA_INSERT and DELTA_UPDATE
+  double m_longitude;
+};
+
+// count, sum and max of a set of power readings
+struct MeterAggregate {
+  MeterAggregate() : m_count(0), m_sum(0), m_max(0) {}
+  long long m_count;
+  double m_sum;
+  double m_max; // 0 while m_count is 0
+  void add(double watts) {
+    m_max = (m_count == 0) ? watts : max(m_max, watts);
+    m_count++;
+    m_sum += watts;
+  }
+  void merge(const MeterAggregate &other) {
+    if (other.m_count > 0) {
+      m_max = (m_count == 0) ? other.m_max : max(m_max, other.m_max);
+      m_count += other.m_count;
+      m_sum += other.m_sum;
+    }
+  }
+  double average() const { return (m_count == 0) ? 0 : m_sum / m_count; }
 };
 
 class WirelessPower {
 public:
   friend class Grader;
   friend class Tester;
+  friend class MutationLog;
+  friend class CombiningWirelessPower;
+  friend class SharedRegistry;
 
   WirelessPower(TREETYPE type);
   ~WirelessPower();
@@ -92,25 +163,196 @@ public:
   const WirelessPower &operator=(const WirelessPower &rhs);
   void clear();
   TREETYPE getType() const;
-  void insert(const Customer &customer); // inserts into BST, AVL, or SPLAY
-  void remove(int id); // only removes from AVL and BST, not from SPLAY
+  // inserts into BST, AVL, SPLAY or REDBLACK
+  void insert(const Customer &customer);
+  // same as insert, but the search starts from the last hinted insert
+  // instead of m_root, so increasing or clustered ids cost O(1) amortized
+  // plus rebalancing. Any other change to the tree drops the hint.
+  void insertHinted(const Customer &customer);
+  // only removes from AVL, REDBLACK and BST, not from SPLAY
+  void remove(int id);
+  // removes every id in [low, high] with one split and one join of the
+  // tree, O(log n + k) for k removed customers
+  void removeRange(int low, int high);
+  // removes every id in ids in one pass, subtrees left without a removed id
+  // are joined back untouched
+  void removeBatch(vector<int> ids);
+  // applies a change set as if every op were called in order (insert,
+  // remove, updateLocation), but sorted by id and merged into the tree in
+  // one pass, so each affected subtree is rebalanced once by a join. Small
+  // batches, where the joins do not pay off, are applied op by op. On a
+  // SKIPLIST an update moves the customer by a remove and an insert.
+  void applyBatch(vector<CustomerDelta> ops);
   // changing type from BST or SPLAY to AVL should transfer all nodes to an AVL
-  // tree
-  void setType(TREETYPE type);
+  // tree, changing to REDBLACK balances the tree and colors every node,
+  // changing to or from SKIPLIST rebuilds from the sorted customers in O(n)
+  // a budget > 0 converts to AVL incrementally, doing at most budget steps
+  // of the conversion during each later insert or remove instead of
+  // converting all at once
+  void setType(TREETYPE type, int budget = 0);
+  // does up to budget steps of a pending conversion, each descends one node
+  // or moves one customer in O(log n), returns true while customers are
+  // still waiting to be converted
+  bool step(int budget);
+  bool isConverting() const;
+  // every later insert and remove is written to log first, nullptr detaches
+  void attachLog(MutationLog *log);
+  // records every later call to trace, starting with the current type and
+  // contents, nullptr detaches
+  void attachTrace(TraceRecorder *trace);
+  // keeps a content hash of every subtree, when both sides hash operator==
+  // compares the root hashes in O(1) and diff skips ranges that match
+  void setHashing(bool hashing);
+  // appends the changes that turn this registry into other to delta
+  void diff(const WirelessPower &other, vector<CustomerDelta> &delta) const;
+  // keeps customer counts per lat/long tile for zoom levels 0..levels-1,
+  // levels is clamped to MAX_TILE_LEVELS and 0 or less turns tiling off
+  void setTiling(int levels);
+  const TileCounts *getTiles() const; // nullptr when tiling is off
+  // keeps the number of customers in every subtree so rank, select and
+  // countRange run in O(log n) instead of walking the tree
+  void setCounting(bool counting);
+  // returns true if id is in the tree, a SPLAY tree splays it to the root
+  bool touch(int id);
+  // bounds a SPLAY registry used as a cache: once it holds an eighth more
+  // than customers, the deepest (least recently splayed) customers are
+  // evicted down to customers. Turns counting on, 0 means unbounded. A byte
+  // budget is budget / sizeof(Customer) customers.
+  void setCapacity(int customers);
+  // parameter is the depth threshold of SPLAY_DEPTH or the probability of
+  // SPLAY_RANDOM, the other policies ignore it
+  void setSplayPolicy(SPLAYPOLICY policy, double parameter = 0);
+  // number of customers with an id below id
+  int rank(int id) const;
+  // id of the customer with k customers below it, DEFAULT_ID if there is none
+  int select(int k) const;
+  // number of customers with an id in [low, high]
+  int countRange(int low, int high) const;
+  // shape of the tree for tools and benchmarks, height is -1 when the tree
+  // is empty and searchPath appends the customers a search for id visits,
+  // root first, without splaying
+  int height() const;
+  void searchPath(int id, vector<const Customer *> &path) const;
+  // rotations done, counted from construction or, while profiling, from
+  // the start of the last call
+  int rotations() const;
+  // copies every customer into contiguous blocks in van Emde Boas order and
+  // rewires the links, so a search touches fewer cache lines. A budget > 0
+  // moves one subtree of at most budget customers per call, left to right,
+  // and returns true while more remain, the nodes near the root move last.
+  bool compact(int budget = 0);
+  // keeps latency histograms of insert, insertHinted, remove, setType and
+  // touch per tree type, and samples every call slower than slowNanos with
+  // its visited nodes and rotations, false turns profiling off
+  void setProfiling(bool profiling, long long slowNanos = 10000);
+  const LatencyStats *getStats() const; // nullptr when profiling is off
+  // keeps compressed power readings per customer (see wpmeter.h), a removed
+  // customer's readings go with it and false drops them all
+  void setMetering(bool metering);
+  // returns false if id is not in the tree, metering is off or time is
+  // before the customer's last reading
+  bool addReading(int id, long long time, double watts);
+  // readings of id with time in [from, to)
+  MeterAggregate aggregate(int id, long long from, long long to) const;
+  // bytes of compressed readings kept for id, 0 when there are none
+  size_t meterBytes(int id) const;
+  // the same over every customer with an id in [low, high], found through
+  // the tree and scanned on up to threads threads
+  MeterAggregate aggregateRange(int low, int high, long long from,
+                                long long to, int threads = 1) const;
+  // readings of every customer, buckets[i] covers [from + i * width,
+  // from + (i + 1) * width)
+  void rollup(long long from, long long to, long long width,
+              vector<MeterAggregate> &buckets, int threads = 1) const;
+  // keeps up to SMALL_CUSTOMERS customers in one sorted array (see
+  // wpsmall.h) instead of a tree, the registry turns into its TREETYPE for
+  // good once it grows past that. Only takes effect while the registry is
+  // that small and not a SKIPLIST, false turns it into a tree right away.
+  void setSmall(bool small);
+  // moves a customer, returns false if id is not in the tree
+  bool updateLocation(int id, double lat, double longitude);
+  // checks every invariant in one pass: global id order, MINID..MAXID,
+  // stored heights, AVL balance or red-black colors, subtree hashes and sizes.
+  // Subtrees near the root are checked on up to threads threads.
+  bool verify(int threads = 1) const;
+  // the same checks along random root-to-leaf paths only, black heights and
+  // anything off those paths are missed but it costs O(paths * height)
+  bool verifySample(int paths, unsigned int seed = 10) const;
 
 private:
   Customer *m_root; // the root of the BST
-  TREETYPE m_type;  // the type of tree, BST, AVL or SPLAY
+  TREETYPE m_type;  // BST, AVL, SPLAY, REDBLACK or SKIPLIST
+
+  // Incremental conversion state. Nodes still to be converted stay in a
+  // plain BST under m_convertRoot, every id in it is larger than every id
+  // under m_root. The old tree may be degenerate, so changes never search
+  // it: inserts above the converted ids go to the AVL tree m_convertAdded
+  // and removes only mark the id in m_convertRemoved. Each step moves the
+  // smallest of both onto the right end of the AVL tree at m_root, so a
+  // full conversion is O(n) work and a step O(log n).
+  Customer *m_convertRoot;
+  Customer *m_convertAdded;
+  // by id - MINID, pending nodes that were removed, empty until the first
+  vector<bool> m_convertRemoved;
+  int m_convertBudget;
+  // path down the left spine of m_convertRoot, one node deeper per step
+  // until the min is on top
+  vector<Customer *> m_oldSpine;
+  vector<Customer *> m_newSpine; // right spine of m_root, max on top
+  MutationLog *m_log;            // not owned, nullptr when not logging
+  TraceRecorder *m_trace;        // not owned, nullptr when not tracing
+  bool m_hashing;                // maintain Customer::m_hash in updateHeight
+  bool m_counting;               // maintain Customer::m_size in updateHeight
+  int m_capacity;                // SPLAY customers kept by evict(), 0 = all
+  TileCounts *m_tiles;           // owned, nullptr when tiling is off
+  // path from m_root to the last hinted insert, each with the open id range
+  // its subtree covers
+  struct Finger {
+    Customer *m_customer;
+    long long m_low;
+    long long m_high;
+  };
+  vector<Finger> m_finger;
+  bool m_compacting;       // an incremental compact() is under way
+  long long m_compactNext; // smallest id it has not moved yet
+  // blocks of nodes laid out by compact(), keyed by their first node, with
+  // the number of nodes in each not freed yet. A block is freed with its
+  // last node, so by the next full compact() or clear() at the latest.
+  struct NodeBlock {
+    size_t m_count;
+    size_t m_live;
+  };
+  map<const Customer *, NodeBlock> m_blocks;
+  LatencyStats *m_stats;   // owned, nullptr when profiling is off
+  int m_visits;            // nodes visited since a profiled call began
+  int m_rotations;         // rotations since a profiled call began
+  // owned, holds the customers while m_type is SKIPLIST
+  LockFreeSkipList *m_skip;
+  // how SPLAY trees restructure, the parameter is a threshold or probability
+  SPLAYPOLICY m_splayPolicy;
+  double m_splayParameter;
+  unsigned long long m_splayRandom; // xorshift state for SPLAY_RANDOM
+  vector<Customer *> m_splayPath;   // nodes to update after a splayDown
+  // owned readings by id - MINID, empty while metering is off
+  vector<MeterSeries *> m_meters;
+  // owned, holds the customers instead of m_root while the registry is
+  // small, nullptr otherwise
+  SmallRegistry *m_small;
   // helper for recursive traversal
   void dump(Customer *customer) const;
   // ***************************************************
   // Any private helper functions must be delared here!
   // ***************************************************
   void clear(Customer *customer);
-  // Helper functions for insertion
+  // Helper functions for insertion, instantiated once per tree type so the
+  // recursion does not branch on m_type in every frame
+  template <TREETYPE type>
   Customer *&insert(Customer *&root, const Customer &customer);
   // Customer*& insertAVL(Customer*& root, const Customer& customer);
   Customer *&splay(Customer *&root, const Customer &customer);
+  // restructures m_root after an access to id as m_splayPolicy asks
+  void splayAccess(int id);
+  Customer *splayDown(Customer *root, int id, bool semi);
   int getHeight(Customer *customer) const;
   void updateHeight(Customer *customer);
 
@@ -124,15 +366,147 @@ private:
   Customer *&rotateLeft(Customer *&customer);
   Customer *&rotateLeftRight(Customer *&customer);
   Customer *&rotateRightLeft(Customer *&customer);
+  void flatten(Customer *root, vector<Customer *> &nodes) const;
+
+  // Helper functions for range removal and batches, join keeps the balance
+  // rules of the tree type and every id in left < mid < every id in right
+  Customer *join(Customer *left, Customer *mid, Customer *right);
+  Customer *joinAVL(Customer *left, Customer *mid, Customer *right);
+  Customer *joinRB(Customer *left, Customer *mid, Customer *right);
+  // the same with the black heights of left and right known, black gets the
+  // black height of the result
+  Customer *joinRB(Customer *left, Customer *mid, Customer *right,
+                   int leftBlack, int rightBlack, int &black);
+  Customer *joinRightRB(Customer *root, Customer *mid, Customer *right,
+                        int rootBlack, int rightBlack);
+  Customer *joinLeftRB(Customer *left, Customer *mid, Customer *root,
+                       int leftBlack, int rootBlack);
+  int blackHeight(const Customer *customer) const;
+  Customer *join2(Customer *left, Customer *right);
+  void split(Customer *root, long long id, Customer *&less, Customer *&rest);
+  Customer *removeBatch(Customer *root, const vector<int> &ids, int low,
+                        int high);
+  void discard(Customer *customer);
+  // black is the black height of root on entry and of the result on return,
+  // so REDBLACK joins never walk a spine to find it
+  Customer *applyBatch(Customer *root, const vector<CustomerDelta> &ops,
+                       int low, int high, int &black);
+  Customer *applyOps(Customer *customer, const vector<CustomerDelta> &ops,
+                     int low, int high);
+  // the DELTA_UPDATE of a skip list, which has no updateLocation(): a
+  // present id is removed and inserted again at its new location
+  void moveSkip(int id, double lat, double longitude);
+
+  // Helper functions for incremental conversion, pendingNodes appends the
+  // customers not converted yet in id order
+  void finishConversion();
+  void convertStep();
+  void appendMax(Customer *customer);
+  Customer *removeMinAVL(Customer *root, Customer *&min);
+  bool removedPending(int id) const;
+  void pendingNodes(vector<Customer *> &nodes) const;
+  Customer *convertedMax();
+  void insertConverting(const Customer &customer);
+  void removeConverting(int id);
+  Customer *buildBalanced(vector<Customer *> &nodes, int low, int high);
+  // Helper functions for SKIPLIST, contents copies every customer in id
+  // order and adopt moves sorted nodes into an empty registry. orderedNodes
+  // appends the customers in id order without copying tree nodes, returns
+  // true if they are copies the caller deletes.
+  void convertSkipList();
+  void contents(vector<Customer *> &nodes) const;
+  bool orderedNodes(vector<Customer *> &nodes) const;
+  void adopt(vector<Customer *> &nodes);
+  void promote(); // moves the customers of m_small into a tree
+
+  // Helper functions for red-black tree, colors are fixed up bottom-up so an
+  // insert does at most two rotations and a remove at most three
+  Customer *insertRB(Customer *root, const Customer &customer);
+  Customer *fixRedRed(Customer *root);
+  Customer *removeRB(Customer *root, int id, bool &shorter);
+  Customer *removeMinRB(Customer *root, Customer *&min, bool &shorter);
+  Customer *fixLeftShort(Customer *root, bool &shorter);
+  Customer *fixRightShort(Customer *root, bool &shorter);
+  void colorFromHeights(Customer *customer, int parentHeight);
+  bool isRed(const Customer *customer) const;
 
   // Helper functions for remove
-  Customer *&remove(Customer *&root, int id);
+  template <TREETYPE type> Customer *&remove(Customer *&root, int id);
   Customer *findMin(Customer *customer) const;
 
+  // Helper functions for subtree hashes and diff
+  bool hashesValid() const;
+  unsigned long long nodeHash(const Customer *customer) const;
+  unsigned long long getHash(const Customer *customer) const;
+  void rehash(Customer *customer);
+
+  // Helper functions for order statistics, sized walks use the stored
+  // subtree sizes and the others count by traversal
+  int getSize(const Customer *customer) const;
+  void resize(Customer *customer);
+  int countBelow(const Customer *customer, long long id, bool sized) const;
+  int countPending(long long id) const; // pending customers below id
+  const Customer *selectNode(const Customer *customer, int &k,
+                             bool sized) const;
+
+  void traceTree(const Customer *customer); // records customer as inserts
+  void recordInsert(const Customer &customer); // log, trace and tiles
+  bool descendFinger(int id);
+
+  // Helper functions for compact(), a region is every node of a subtree
+  // with a height above stop
+  Customer **findChunk(Customer **slot, long long next, int stop);
+  void vebOrder(Customer *root, int levels, int stop,
+                vector<Customer *> &order);
+  void atDepth(Customer *customer, int depth, int stop,
+               vector<Customer *> &frontier);
+  void relayout(Customer **slot, int stop);
+  Customer *allocateBlock(size_t count);
+  void freeNode(Customer *customer); // wherever it was allocated
+
+  // Helper functions for capacity eviction
+  void evict();
+  void countDepths(const Customer *customer, int depth,
+                   vector<int> &levels) const;
+  Customer *prune(Customer *customer, int depth, int maxDepth, int &keepAtMax);
+  unsigned long long hashBelow(const Customer *customer, long long id) const;
+  unsigned long long rangeHash(long long low, long long high) const;
+  const Customer *findNode(int id) const;
+  void diffRange(const WirelessPower &other, long long low, long long high,
+                 vector<CustomerDelta> &delta) const;
+  void diffNodes(const Customer *mine, const Customer *theirs,
+                 vector<CustomerDelta> &delta) const;
+
+  // Helper functions for metering, width 0 scans [from, to) as one bucket
+  void dropReadings(int id);
+  void metered(const Customer *customer, int low, int high,
+               vector<const MeterSeries *> &series) const;
+  void scan(int low, int high, long long from, long long to, long long width,
+            vector<MeterAggregate> &buckets, int threads) const;
+
+  // Helper functions for tiling
+  void addTiles(const Customer *customer);
+  bool updateLocation(Customer *customer, int id, double lat,
+                      double longitude);
+
+  // Helper functions for verify
+  struct SubtreeCheck {
+    bool m_valid;
+    int m_height;
+    int m_blackHeight;
+  };
+  SubtreeCheck verify(const Customer *customer, long long low, long long high,
+                      bool pending, int parallelDepth) const;
+  bool verifyNode(const Customer *customer, long long low,
+                  long long high) const;
+
   // Helper functions for assignment operator
   Customer *copyTree(Customer *&root);
+  // equal when both hold the same ids at the same locations, whatever the
+  // storage or shape. When both keep valid hashes this is an O(1) root hash
+  // compare, so it is probabilistic: a 64-bit collision reads as equal.
+  // Otherwise both are walked in id order.
   bool operator==(const WirelessPower &rhs) const;
-  bool equalityOperator(const Customer *lhs, const Customer *rhs) const;
 
   // 2D printed tree
   void print2D(Customer *customer, int space);
@@ -145,6 +519,9 @@ private:
   bool find(int id) const;
   bool find(int id, const Customer *customer) const;
   bool checkHeight(Customer *&root) const;
+  bool checkRedBlack() const;
+  int checkRedBlack(const Customer *customer) const;
+  bool checkHashes(const Customer *customer) const;
 };
 
 #endif
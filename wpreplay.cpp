@@ -0,0 +1,111 @@
+#include "wprandom.h"
+#include "wptrace.h"
+#include "wpower.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Replays a trace recorded with TraceRecorder, or generates a synthetic one.
+//   wpreplay generate <trace> [ops] [uniform|normal]
+//   wpreplay <trace> [BST|AVL|SPLAY|REDBLACK|SKIPLIST] [paced]
+// A given type replaces every SETTYPE record of the trace. paced sleeps
+// until each record's original timestamp instead of running at full speed.
+
+typedef std::chrono::steady_clock Clock;
+
+// half inserts, a quarter removes and a quarter lookups, one every
+// microsecond, ids drawn from the existing Random distributions
+bool generate(const string &path, int ops, RANDOM type) {
+  Random idGen(MINID, MAXID, type, (MINID + MAXID) / 2, (MAXID - MINID) / 8);
+  idGen.setSeed(10); // NORMAL seeds from the device otherwise
+  Random latGen(MINLAT, MAXLAT, UNIFORMREAL);
+  Random longGen(MINLONG, MAXLONG, UNIFORMREAL);
+  Random opGen(0, 3);
+  vector<TraceRecord> records;
+  records.push_back(TraceRecord{TRACE_SETTYPE, AVL, 0, 0, 0});
+  for (int i = 0; i < ops; i++) {
+    int op = opGen.getRandNum();
+    int id = idGen.getRandNum();
+    if (op < 2) {
+      records.push_back(TraceRecord{TRACE_INSERT, id, latGen.getRealRandNum(),
+                                    longGen.getRealRandNum(), i});
+    } else {
+      records.push_back(
+          TraceRecord{op == 2 ? TRACE_REMOVE : TRACE_LOOKUP, id, 0, 0, i});
+    }
+  }
+  return TraceRecorder::write(path, records);
+}
+
+bool parseType(const char *name, TREETYPE &type) {
+  const char *names[] = {"BST", "AVL", "SPLAY", "REDBLACK", "SKIPLIST"};
+  for (int i = 0; i < 5; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      type = (TREETYPE)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 3 && strcmp(argv[1], "generate") == 0) {
+    int ops = (argc >= 4) ? atoi(argv[3]) : 1000000;
+    RANDOM type = (argc >= 5 && strcmp(argv[4], "normal") == 0) ? NORMAL
+                                                                 : UNIFORMINT;
+    if (!generate(argv[2], ops, type)) {
+      cout << "cannot write " << argv[2] << endl;
+      return 1;
+    }
+    cout << "wrote " << ops << " ops to " << argv[2] << endl;
+    return 0;
+  }
+  vector<TraceRecord> records;
+  if (argc < 2 || !TraceRecorder::read(argv[1], records)) {
+    cout << "usage: wpreplay <trace> [BST|AVL|SPLAY|REDBLACK|SKIPLIST] [paced]"
+         << endl;
+    cout << "       wpreplay generate <trace> [ops] [uniform|normal]" << endl;
+    return 1;
+  }
+  TREETYPE type = AVL;
+  bool forced = argc >= 3 && parseType(argv[2], type);
+  bool paced = strcmp(argv[argc - 1], "paced") == 0;
+
+  WirelessPower wp(type);
+  vector<long long> latencies;
+  latencies.reserve(records.size());
+  Clock::time_point start = Clock::now();
+  for (const TraceRecord &record : records) {
+    if (paced) {
+      std::this_thread::sleep_until(start +
+                                    std::chrono::microseconds(record.m_micros));
+    }
+    Clock::time_point before = Clock::now();
+    TraceRecorder::apply(record, wp, !forced);
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            Clock::now() - before)
+                            .count());
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  sort(latencies.begin(), latencies.end());
+  cout << records.size() << " ops in " << seconds * 1000 << " ms, "
+       << records.size() / seconds << " ops/s" << endl;
+  if (!latencies.empty()) {
+    double percentiles[] = {50, 90, 99, 99.9};
+    cout << "latency ns:";
+    for (double percentile : percentiles) {
+      size_t index = (size_t)(percentile / 100 * (latencies.size() - 1));
+      cout << " p" << percentile << " " << latencies[index];
+    }
+    cout << " max " << latencies.back() << endl;
+  }
+  cout << "final tree: " << wp.countRange(MINID, MAXID) << " customers, height "
+       << wp.height() << ", verify " << wp.verify() << endl;
+  return 0;
+}
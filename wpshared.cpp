@@ -0,0 +1,395 @@
+#include "wpshared.h"
+#include <climits>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// the nodes start on their own cache line after the header
+static size_t headerBytes() { return (sizeof(SharedHeader) + 63) / 64 * 64; }
+
+SharedRegistry::SharedRegistry(const string &name, int capacity)
+    : m_fd(-1), m_map(MAP_FAILED), m_bytes(0), m_writer(true),
+      m_header(nullptr), m_nodes(nullptr), m_retries(0) {
+  m_bytes = headerBytes() + (size_t)max(0, capacity) * sizeof(SharedNode);
+  m_fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (m_fd < 0 || ftruncate(m_fd, m_bytes) != 0) {
+    return;
+  }
+  m_map = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (m_map == MAP_FAILED) {
+    return;
+  }
+  // a fresh segment reads as zeros, which is an empty tree of free slots
+  m_header = new (m_map) SharedHeader();
+  m_header->m_capacity = max(0, capacity);
+  m_header->m_version.store(0);
+  m_header->m_root.store(0);
+  m_header->m_size.store(0);
+  m_header->m_used = 0;
+  m_header->m_free = 0;
+  m_nodes = (SharedNode *)((char *)m_map + headerBytes());
+  m_header->m_magic = SHARED_MAGIC; // written last, readers check it
+}
+
+SharedRegistry::SharedRegistry(const string &name)
+    : m_fd(-1), m_map(MAP_FAILED), m_bytes(0), m_writer(false),
+      m_header(nullptr), m_nodes(nullptr), m_retries(0) {
+  m_fd = shm_open(name.c_str(), O_RDONLY, 0);
+  struct stat info;
+  if (m_fd < 0 || fstat(m_fd, &info) != 0 ||
+      (size_t)info.st_size < headerBytes()) {
+    return;
+  }
+  m_bytes = info.st_size;
+  m_map = mmap(nullptr, m_bytes, PROT_READ, MAP_SHARED, m_fd, 0);
+  if (m_map == MAP_FAILED) {
+    return;
+  }
+  const SharedHeader *header = (const SharedHeader *)m_map;
+  if (header->m_magic != SHARED_MAGIC ||
+      headerBytes() + (size_t)header->m_capacity * sizeof(SharedNode) >
+          m_bytes) {
+    return; // not ours, or not created yet
+  }
+  m_header = (SharedHeader *)m_map;
+  m_nodes = (SharedNode *)((char *)m_map + headerBytes());
+}
+
+SharedRegistry::~SharedRegistry() {
+  if (m_map != MAP_FAILED) {
+    munmap(m_map, m_bytes);
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+bool SharedRegistry::isOpen() const { return m_header != nullptr; }
+
+bool SharedRegistry::unlink(const string &name) {
+  return shm_unlink(name.c_str()) == 0;
+}
+
+void SharedRegistry::beginChange() {
+  m_header->m_version.store(m_header->m_version.load() + 1,
+                            std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedRegistry::endChange() {
+  m_header->m_version.store(m_header->m_version.load() + 1,
+                            std::memory_order_release);
+}
+
+bool SharedRegistry::insert(const Customer &customer) {
+  if (!isOpen() || !m_writer) {
+    return false;
+  }
+  if (m_header->m_free == 0 && m_header->m_used == m_header->m_capacity &&
+      !contains(customer.getID())) {
+    return false; // full, and the id would need a slot
+  }
+  bool added = false;
+  beginChange();
+  m_header->m_root.store(insert(m_header->m_root.load(), customer, added),
+                         std::memory_order_relaxed);
+  if (added) {
+    m_header->m_size.store(m_header->m_size.load() + 1,
+                           std::memory_order_relaxed);
+  }
+  endChange();
+  return true;
+}
+
+int SharedRegistry::insert(int slot, const Customer &customer, bool &added) {
+  if (slot == 0) {
+    added = true;
+    return allocate(customer);
+  }
+  SharedNode &current = node(slot);
+  int id = current.m_id.load(std::memory_order_relaxed);
+  if (customer.getID() == id) {
+    return slot; // a present id keeps its location
+  } else if (customer.getID() < id) {
+    current.m_left.store(insert(current.m_left.load(), customer, added),
+                         std::memory_order_relaxed);
+  } else {
+    current.m_right.store(insert(current.m_right.load(), customer, added),
+                          std::memory_order_relaxed);
+  }
+  updateHeight(slot);
+  return balance(slot);
+}
+
+bool SharedRegistry::remove(int id) {
+  if (!isOpen() || !m_writer || !contains(id)) {
+    return false;
+  }
+  bool removed = false;
+  beginChange();
+  m_header->m_root.store(remove(m_header->m_root.load(), id, removed),
+                         std::memory_order_relaxed);
+  m_header->m_size.store(m_header->m_size.load() - 1,
+                         std::memory_order_relaxed);
+  endChange();
+  return removed;
+}
+
+int SharedRegistry::remove(int slot, int id, bool &removed) {
+  if (slot == 0) {
+    return 0;
+  }
+  SharedNode &current = node(slot);
+  int currentID = current.m_id.load(std::memory_order_relaxed);
+  if (id < currentID) {
+    current.m_left.store(remove(current.m_left.load(), id, removed),
+                         std::memory_order_relaxed);
+  } else if (id > currentID) {
+    current.m_right.store(remove(current.m_right.load(), id, removed),
+                          std::memory_order_relaxed);
+  } else {
+    removed = true;
+    int left = current.m_left.load();
+    int right = current.m_right.load();
+    if (left == 0 || right == 0) {
+      release(slot);
+      return (left == 0) ? right : left;
+    }
+    // the successor's slot takes the place of the removed one
+    int min = 0;
+    right = removeMin(right, min);
+    node(min).m_left.store(left, std::memory_order_relaxed);
+    node(min).m_right.store(right, std::memory_order_relaxed);
+    release(slot);
+    slot = min;
+  }
+  updateHeight(slot);
+  return balance(slot);
+}
+
+int SharedRegistry::removeMin(int slot, int &min) {
+  SharedNode &current = node(slot);
+  if (current.m_left.load() == 0) {
+    min = slot;
+    return current.m_right.load();
+  }
+  current.m_left.store(removeMin(current.m_left.load(), min),
+                       std::memory_order_relaxed);
+  updateHeight(slot);
+  return balance(slot);
+}
+
+bool SharedRegistry::load(const WirelessPower &wp) {
+  if (!isOpen() || !m_writer) {
+    return false;
+  }
+  vector<Customer *> nodes;
+  wp.contents(nodes);
+  bool fits = (int)nodes.size() <= m_header->m_capacity;
+  if (fits) {
+    beginChange();
+    m_header->m_used = 0; // every old slot is dropped at once
+    m_header->m_free = 0;
+    m_header->m_root.store(build(nodes, 0, (int)nodes.size() - 1),
+                           std::memory_order_relaxed);
+    m_header->m_size.store((int)nodes.size(), std::memory_order_relaxed);
+    endChange();
+  }
+  for (Customer *customer : nodes) {
+    delete customer;
+  }
+  return fits;
+}
+
+int SharedRegistry::build(const vector<Customer *> &nodes, int low,
+                          int high) {
+  if (low > high) {
+    return 0;
+  }
+  int mid = low + (high - low) / 2;
+  int slot = allocate(*nodes[mid]);
+  node(slot).m_left.store(build(nodes, low, mid - 1),
+                          std::memory_order_relaxed);
+  node(slot).m_right.store(build(nodes, mid + 1, high),
+                           std::memory_order_relaxed);
+  updateHeight(slot);
+  return slot;
+}
+
+int SharedRegistry::allocate(const Customer &customer) {
+  int slot = m_header->m_free;
+  if (slot != 0) {
+    m_header->m_free = node(slot).m_height;
+  } else {
+    slot = ++m_header->m_used;
+  }
+  SharedNode &fresh = node(slot);
+  fresh.m_id.store(customer.getID(), std::memory_order_relaxed);
+  fresh.m_latitude.store(customer.getLatitude(), std::memory_order_relaxed);
+  fresh.m_longitude.store(customer.getLongitude(), std::memory_order_relaxed);
+  fresh.m_left.store(0, std::memory_order_relaxed);
+  fresh.m_right.store(0, std::memory_order_relaxed);
+  fresh.m_height = 1;
+  return slot;
+}
+
+void SharedRegistry::release(int slot) {
+  node(slot).m_height = m_header->m_free;
+  m_header->m_free = slot;
+}
+
+int SharedRegistry::height(int slot) const {
+  return (slot == 0) ? 0 : node(slot).m_height;
+}
+
+void SharedRegistry::updateHeight(int slot) {
+  SharedNode &current = node(slot);
+  current.m_height =
+      1 + max(height(current.m_left.load()), height(current.m_right.load()));
+}
+
+int SharedRegistry::rotateLeft(int slot) {
+  int right = node(slot).m_right.load();
+  node(slot).m_right.store(node(right).m_left.load(),
+                           std::memory_order_relaxed);
+  node(right).m_left.store(slot, std::memory_order_relaxed);
+  updateHeight(slot);
+  updateHeight(right);
+  return right;
+}
+
+int SharedRegistry::rotateRight(int slot) {
+  int left = node(slot).m_left.load();
+  node(slot).m_left.store(node(left).m_right.load(),
+                          std::memory_order_relaxed);
+  node(left).m_right.store(slot, std::memory_order_relaxed);
+  updateHeight(slot);
+  updateHeight(left);
+  return left;
+}
+
+int SharedRegistry::balance(int slot) {
+  SharedNode &current = node(slot);
+  int factor = height(current.m_left.load()) - height(current.m_right.load());
+  if (factor > 1) {
+    int left = current.m_left.load();
+    if (height(node(left).m_left.load()) < height(node(left).m_right.load())) {
+      current.m_left.store(rotateLeft(left), std::memory_order_relaxed);
+    }
+    return rotateRight(slot);
+  }
+  if (factor < -1) {
+    int right = current.m_right.load();
+    if (height(node(right).m_right.load()) <
+        height(node(right).m_left.load())) {
+      current.m_right.store(rotateRight(right), std::memory_order_relaxed);
+    }
+    return rotateLeft(slot);
+  }
+  return slot;
+}
+
+bool SharedRegistry::search(int id, Customer &found, bool &present) const {
+  present = false;
+  int slot = m_header->m_root.load(std::memory_order_relaxed);
+  int capacity = m_header->m_capacity;
+  for (int depth = 0; slot != 0; depth++) {
+    if (slot < 0 || slot > capacity || depth == SHARED_MAX_DEPTH) {
+      return false; // a link seen halfway through a change
+    }
+    const SharedNode &current = node(slot);
+    int currentID = current.m_id.load(std::memory_order_relaxed);
+    if (id == currentID) {
+      found.setID(id);
+      found.setLatitude(current.m_latitude.load(std::memory_order_relaxed));
+      found.setLongitude(current.m_longitude.load(std::memory_order_relaxed));
+      present = true;
+      return true;
+    }
+    slot = (id < currentID) ? current.m_left.load(std::memory_order_relaxed)
+                            : current.m_right.load(std::memory_order_relaxed);
+  }
+  return true;
+}
+
+bool SharedRegistry::find(int id, Customer &found) const {
+  if (!isOpen()) {
+    return false;
+  }
+  if (m_writer) { // nothing changes under the writer's own search
+    bool present = false;
+    search(id, found, present);
+    return present;
+  }
+  while (true) {
+    unsigned long long before =
+        m_header->m_version.load(std::memory_order_acquire);
+    bool present = false;
+    if (before % 2 == 0 && search(id, found, present)) {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_header->m_version.load(std::memory_order_relaxed) == before) {
+        return present;
+      }
+    }
+    m_retries++;
+    if (before % 2 == 1) {
+      std::this_thread::yield(); // let the writer finish
+    }
+  }
+}
+
+bool SharedRegistry::contains(int id) const {
+  Customer found(id, 0, 0);
+  return find(id, found);
+}
+
+int SharedRegistry::size() const {
+  return isOpen() ? m_header->m_size.load(std::memory_order_acquire) : 0;
+}
+
+size_t SharedRegistry::bytes() const { return m_bytes; }
+
+long long SharedRegistry::retries() const { return m_retries; }
+
+bool SharedRegistry::verify() const {
+  if (!isOpen() || !m_writer || m_header->m_version.load() % 2 == 1) {
+    return false;
+  }
+  int count = 0;
+  int free = 0;
+  for (int slot = m_header->m_free; slot != 0 && free <= m_header->m_used;
+       slot = node(slot).m_height) {
+    free++;
+  }
+  return verify(m_header->m_root.load(), LLONG_MIN, LLONG_MAX, count) >= 0 &&
+         count == m_header->m_size.load() &&
+         count + free == m_header->m_used &&
+         m_header->m_used <= m_header->m_capacity;
+}
+
+int SharedRegistry::verify(int slot, long long low, long long high,
+                           int &count) const {
+  // returns the height of the subtree, -1 if anything is wrong in it
+  if (slot == 0) {
+    return 0;
+  }
+  if (slot < 0 || slot > m_header->m_used) {
+    return -1;
+  }
+  const SharedNode &current = node(slot);
+  int id = current.m_id.load();
+  if (id <= low || id >= high || id < MINID || id > MAXID) {
+    return -1;
+  }
+  count++;
+  int left = verify(current.m_left.load(), low, id, count);
+  int right = verify(current.m_right.load(), id, high, count);
+  if (left < 0 || right < 0 || left - right > 1 || right - left > 1 ||
+      current.m_height != 1 + max(left, right)) {
+    return -1;
+  }
+  return current.m_height;
+}
@@ -0,0 +1,101 @@
+#ifndef WPSHARED_H
+#define WPSHARED_H
+#include "wpower.h"
+#include <atomic>
+#include <cstdint>
+
+// An AVL registry whose nodes live in a POSIX shared-memory segment, so
+// pre-forked worker processes search one copy instead of building their own.
+// Links are slot numbers inside the segment rather than pointers, so every
+// process may map it at a different address.
+//
+// One process writes and any number of processes read at the same time
+// under a seqlock: the writer makes the version odd for the length of each
+// change and even again afterwards, a reader retries any search that began
+// on an odd version or ended on a different one. A search may meet a half
+// made change, so it checks every slot it follows and gives up below
+// SHARED_MAX_DEPTH levels before it is retried. A writer that dies inside a
+// change leaves the version odd and its readers waiting.
+
+#define SHARED_MAX_DEPTH 64 // far above the height of any AVL tree that fits
+#define SHARED_MAGIC 0x57505348
+
+struct SharedNode {
+  std::atomic<int> m_id;
+  std::atomic<double> m_latitude;
+  std::atomic<double> m_longitude;
+  std::atomic<int> m_left; // slot + 1, 0 for none
+  std::atomic<int> m_right;
+  int m_height; // only read by the writer, next free slot while free
+};
+
+struct SharedHeader {
+  int m_magic;
+  int m_capacity;
+  std::atomic<unsigned long long> m_version; // odd while a change runs
+  std::atomic<int> m_root;                   // slot + 1, 0 when empty
+  std::atomic<int> m_size;
+  int m_used; // slots ever handed out
+  int m_free; // slot + 1 of the first free slot, 0 for none
+};
+
+class SharedRegistry {
+public:
+  friend class Tester;
+
+  // creates or truncates the segment /name with room for capacity customers
+  // and maps it for writing
+  SharedRegistry(const string &name, int capacity);
+  // maps an existing segment read-only
+  SharedRegistry(const string &name);
+  ~SharedRegistry(); // unmaps, the segment stays until unlink()
+  bool isOpen() const;
+  static bool unlink(const string &name);
+
+  // writer only, the same as WirelessPower insert and remove except that
+  // insert returns false when every slot is taken
+  bool insert(const Customer &customer);
+  bool remove(int id); // returns false if id is not present
+  // replaces the contents with every customer of wp, built balanced in O(n),
+  // returns false if they do not fit
+  bool load(const WirelessPower &wp);
+
+  // any process, found gets the location of id
+  bool find(int id, Customer &found) const;
+  bool contains(int id) const;
+  int size() const;
+  size_t bytes() const; // size of the whole segment
+  long long retries() const; // searches this process had to repeat
+  // writer only: id order, stored heights and AVL balance, slot accounting
+  bool verify() const;
+
+private:
+  int m_fd;
+  void *m_map;
+  size_t m_bytes;
+  bool m_writer;
+  SharedHeader *m_header;
+  SharedNode *m_nodes; // slot s is m_nodes[s - 1]
+  mutable long long m_retries;
+
+  // helpers for the writer, each runs inside one odd version
+  void beginChange();
+  void endChange();
+  int allocate(const Customer &customer);
+  void release(int slot);
+  SharedNode &node(int slot) const { return m_nodes[slot - 1]; }
+  int height(int slot) const;
+  void updateHeight(int slot);
+  int rotateLeft(int slot);
+  int rotateRight(int slot);
+  int balance(int slot);
+  int insert(int slot, const Customer &customer, bool &added);
+  int remove(int slot, int id, bool &removed);
+  int removeMin(int slot, int &min);
+  int build(const vector<Customer *> &nodes, int low, int high);
+  int verify(int slot, long long low, long long high, int &count) const;
+  // one pass of a search, false if it must be retried
+  bool search(int id, Customer &found, bool &present) const;
+};
+
+#endif
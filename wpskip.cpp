@@ -0,0 +1,411 @@
+#include "wpskip.h"
+#include <climits>
+#include <new>
+
+#define RETIRE_BATCH 64 // retired nodes between attempts to advance
+
+static SkipNode *unmarked(uintptr_t link) {
+  return (SkipNode *)(link & ~(uintptr_t)1);
+}
+
+static bool isMarked(uintptr_t link) { return (link & 1) != 0; }
+
+static void deleteNode(SkipNode *node) {
+  ::operator delete(node); // the links live in the same block
+}
+
+// one per thread that has used a skip list, never freed so the list of
+// records stays valid for every thread that walks it
+struct EpochRecord {
+  std::atomic<unsigned long long> m_epoch; // global epoch seen on entry
+  std::atomic<bool> m_active;              // inside an operation
+  std::atomic<bool> m_inUse;               // claimed by a live thread
+  EpochRecord *m_next;
+  vector<SkipNode *> m_retired[3]; // by epoch % 3, only touched by the owner
+  int m_sinceAdvance;
+};
+
+static std::atomic<unsigned long long> globalEpoch(0);
+static std::atomic<EpochRecord *> epochRecords(nullptr);
+
+// a record released by an exiting thread keeps its retired nodes, the next
+// thread to claim it frees them in time
+static EpochRecord *claimRecord() {
+  for (EpochRecord *record = epochRecords.load(); record != nullptr;
+       record = record->m_next) {
+    bool free = false;
+    if (record->m_inUse.compare_exchange_strong(free, true)) {
+      return record;
+    }
+  }
+  EpochRecord *record = new EpochRecord();
+  record->m_epoch.store(0);
+  record->m_active.store(false);
+  record->m_inUse.store(true);
+  record->m_sinceAdvance = 0;
+  EpochRecord *head = epochRecords.load();
+  do {
+    record->m_next = head;
+  } while (!epochRecords.compare_exchange_weak(head, record));
+  return record;
+}
+
+class EpochThread {
+public:
+  EpochThread() : m_record(nullptr) {}
+  ~EpochThread() {
+    if (m_record != nullptr) {
+      m_record->m_inUse.store(false);
+    }
+  }
+  EpochRecord *record() {
+    if (m_record == nullptr) {
+      m_record = claimRecord();
+    }
+    return m_record;
+  }
+
+private:
+  EpochRecord *m_record;
+};
+
+static thread_local EpochThread epochThread;
+
+// the global epoch moves on once every active thread has seen it
+static void tryAdvance() {
+  unsigned long long epoch = globalEpoch.load();
+  for (EpochRecord *record = epochRecords.load(); record != nullptr;
+       record = record->m_next) {
+    if (record->m_active.load() && record->m_epoch.load() != epoch) {
+      return;
+    }
+  }
+  globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+// keeps the calling thread inside the current epoch while it lives
+class EpochGuard {
+public:
+  EpochGuard() : m_record(epochThread.record()) {
+    unsigned long long epoch = globalEpoch.load();
+    m_record->m_epoch.store(epoch);
+    m_record->m_active.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // nodes filed under (epoch + 1) % 3 were retired by epoch - 2 at the
+    // latest, nobody can reach them any more
+    vector<SkipNode *> &safe = m_record->m_retired[(epoch + 1) % 3];
+    for (SkipNode *node : safe) {
+      deleteNode(node);
+    }
+    safe.clear();
+  }
+  ~EpochGuard() { m_record->m_active.store(false); }
+  void retire(SkipNode *node) {
+    m_record->m_retired[globalEpoch.load() % 3].push_back(node);
+    if (++m_record->m_sinceAdvance >= RETIRE_BATCH) {
+      m_record->m_sinceAdvance = 0;
+      tryAdvance();
+    }
+  }
+
+private:
+  EpochRecord *m_record;
+};
+
+LockFreeSkipList::LockFreeSkipList() {
+  m_head = newNode(INT_MIN, 0, 0, SKIP_LEVELS);
+  m_tail = newNode(INT_MAX, 0, 0, SKIP_LEVELS);
+  for (int level = 0; level < SKIP_LEVELS; level++) {
+    m_head->m_next[level].store((uintptr_t)m_tail);
+  }
+}
+
+LockFreeSkipList::~LockFreeSkipList() {
+  clear();
+  deleteNode(m_head);
+  deleteNode(m_tail);
+}
+
+SkipNode *LockFreeSkipList::newNode(int id, double lat, double longitude,
+                                    int levels) {
+  // one block for the node and its links, so a step along a level touches
+  // one allocation
+  char *block = (char *)::operator new(sizeof(SkipNode) +
+                                       levels * sizeof(std::atomic<uintptr_t>));
+  SkipNode *node = new (block) SkipNode;
+  node->m_id = id;
+  node->m_latitude = lat;
+  node->m_longitude = longitude;
+  node->m_levels = levels;
+  node->m_next = (std::atomic<uintptr_t> *)(block + sizeof(SkipNode));
+  for (int level = 0; level < levels; level++) {
+    new (&node->m_next[level]) std::atomic<uintptr_t>(0);
+  }
+  node->m_owners.store(2, std::memory_order_relaxed);
+  return node;
+}
+
+int LockFreeSkipList::randomLevels() {
+  static thread_local unsigned long long state = 0;
+  if (state == 0) {
+    state = (unsigned long long)(uintptr_t)&state | 1; // differs per thread
+  }
+  state ^= state << 13; // xorshift64
+  state ^= state >> 7;
+  state ^= state << 17;
+  int levels = 1;
+  unsigned long long bits = state;
+  while (levels < SKIP_LEVELS && (bits & 1)) {
+    levels++;
+    bits >>= 1;
+  }
+  return levels;
+}
+
+bool LockFreeSkipList::find(int id, SkipNode **preds, SkipNode **succs) {
+retry:
+  SkipNode *pred = m_head;
+  for (int level = SKIP_LEVELS - 1; level >= 0; level--) {
+    SkipNode *curr = unmarked(pred->m_next[level].load());
+    while (true) {
+      uintptr_t succ = curr->m_next[level].load();
+      while (isMarked(succ)) { // curr is removed, unlink it here
+        uintptr_t expected = (uintptr_t)curr;
+        if (!pred->m_next[level].compare_exchange_strong(
+                expected, (uintptr_t)unmarked(succ))) {
+          goto retry; // pred changed or was removed itself
+        }
+        curr = unmarked(succ);
+        succ = curr->m_next[level].load();
+      }
+      if (curr->m_id >= id) {
+        break;
+      }
+      pred = curr;
+      curr = unmarked(succ);
+    }
+    preds[level] = pred;
+    succs[level] = curr;
+  }
+  return succs[0]->m_id == id;
+}
+
+bool LockFreeSkipList::insert(int id, double lat, double longitude) {
+  EpochGuard guard;
+  SkipNode *preds[SKIP_LEVELS];
+  SkipNode *succs[SKIP_LEVELS];
+  SkipNode *node = nullptr;
+  while (true) {
+    if (find(id, preds, succs)) {
+      if (node != nullptr) {
+        deleteNode(node); // never published
+      }
+      return false;
+    }
+    if (node == nullptr) {
+      node = newNode(id, lat, longitude, randomLevels());
+    }
+    for (int level = 0; level < node->m_levels; level++) {
+      node->m_next[level].store((uintptr_t)succs[level]);
+    }
+    // the node is in the list once it is linked on the bottom level
+    uintptr_t expected = (uintptr_t)succs[0];
+    if (preds[0]->m_next[0].compare_exchange_strong(expected,
+                                                     (uintptr_t)node)) {
+      break;
+    }
+  }
+  for (int level = 1; level < node->m_levels; level++) {
+    while (true) {
+      uintptr_t link = node->m_next[level].load();
+      if (isMarked(link)) {
+        goto linked; // removed already, stop raising it
+      }
+      if (unmarked(link) != succs[level] &&
+          !node->m_next[level].compare_exchange_strong(
+              link, (uintptr_t)succs[level])) {
+        continue;
+      }
+      uintptr_t expected = (uintptr_t)succs[level];
+      if (preds[level]->m_next[level].compare_exchange_strong(
+              expected, (uintptr_t)node)) {
+        break;
+      }
+      find(id, preds, succs);
+      if (succs[0] != node) {
+        goto linked; // removed and unlinked meanwhile
+      }
+    }
+  }
+linked:
+  if (isMarked(node->m_next[0].load())) {
+    find(id, preds, succs); // unlink any level raised after the remove
+  }
+  if (node->m_owners.fetch_sub(1) == 1) {
+    guard.retire(node);
+  }
+  return true;
+}
+
+bool LockFreeSkipList::remove(int id) {
+  EpochGuard guard;
+  SkipNode *preds[SKIP_LEVELS];
+  SkipNode *succs[SKIP_LEVELS];
+  if (!find(id, preds, succs)) {
+    return false;
+  }
+  SkipNode *node = succs[0];
+  for (int level = node->m_levels - 1; level > 0; level--) {
+    uintptr_t link = node->m_next[level].load();
+    while (!isMarked(link) &&
+           !node->m_next[level].compare_exchange_weak(link, link | 1)) {
+    }
+  }
+  // whoever marks the bottom level removes the node
+  uintptr_t link = node->m_next[0].load();
+  while (true) {
+    if (isMarked(link)) {
+      return false;
+    }
+    if (node->m_next[0].compare_exchange_strong(link, link | 1)) {
+      break;
+    }
+  }
+  find(id, preds, succs); // unlinks the node on every level
+  if (node->m_owners.fetch_sub(1) == 1) {
+    guard.retire(node);
+  }
+  return true;
+}
+
+bool LockFreeSkipList::contains(int id) const {
+  EpochGuard guard;
+  SkipNode *pred = m_head;
+  SkipNode *curr = nullptr;
+  for (int level = SKIP_LEVELS - 1; level >= 0; level--) {
+    curr = unmarked(pred->m_next[level].load());
+    while (true) {
+      uintptr_t succ = curr->m_next[level].load();
+      while (isMarked(succ)) { // step over removed nodes without unlinking
+        curr = unmarked(succ);
+        succ = curr->m_next[level].load();
+      }
+      if (curr->m_id >= id) {
+        break;
+      }
+      pred = curr;
+      curr = unmarked(succ);
+    }
+  }
+  return curr->m_id == id && !isMarked(curr->m_next[0].load());
+}
+
+int LockFreeSkipList::countRange(int low, int high) const {
+  EpochGuard guard;
+  SkipNode *pred = m_head;
+  for (int level = SKIP_LEVELS - 1; level >= 0; level--) {
+    SkipNode *curr = unmarked(pred->m_next[level].load());
+    while (curr->m_id < low) {
+      pred = curr;
+      curr = unmarked(curr->m_next[level].load());
+    }
+  }
+  int count = 0;
+  uintptr_t link = pred->m_next[0].load();
+  while (unmarked(link)->m_id <= high) {
+    SkipNode *node = unmarked(link);
+    link = node->m_next[0].load();
+    if (node->m_id >= low && !isMarked(link)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void LockFreeSkipList::clear() {
+  SkipNode *node = unmarked(m_head->m_next[0].load());
+  while (node != m_tail) {
+    SkipNode *next = unmarked(node->m_next[0].load());
+    deleteNode(node);
+    node = next;
+  }
+  for (int level = 0; level < SKIP_LEVELS; level++) {
+    m_head->m_next[level].store((uintptr_t)m_tail);
+  }
+}
+
+void LockFreeSkipList::build(const vector<Customer *> &nodes) {
+  SkipNode *last[SKIP_LEVELS];
+  for (int level = 0; level < SKIP_LEVELS; level++) {
+    last[level] = m_head;
+  }
+  for (const Customer *customer : nodes) {
+    SkipNode *node = newNode(customer->getID(), customer->getLatitude(),
+                             customer->getLongitude(), randomLevels());
+    node->m_owners.store(1, std::memory_order_relaxed); // nobody is raising it
+    for (int level = 0; level < node->m_levels; level++) {
+      last[level]->m_next[level].store((uintptr_t)node,
+                                       std::memory_order_relaxed);
+      last[level] = node;
+    }
+  }
+  for (int level = 0; level < SKIP_LEVELS; level++) {
+    last[level]->m_next[level].store((uintptr_t)m_tail);
+  }
+}
+
+void LockFreeSkipList::collect(vector<Customer *> &nodes) const {
+  for (SkipNode *node = unmarked(m_head->m_next[0].load()); node != m_tail;
+       node = unmarked(node->m_next[0].load())) {
+    if (!isMarked(node->m_next[0].load())) {
+      nodes.push_back(
+          new Customer(node->m_id, node->m_latitude, node->m_longitude));
+    }
+  }
+}
+
+int LockFreeSkipList::size() const {
+  int count = 0;
+  for (SkipNode *node = unmarked(m_head->m_next[0].load()); node != m_tail;
+       node = unmarked(node->m_next[0].load())) {
+    count++;
+  }
+  return count;
+}
+
+void LockFreeSkipList::dump() const {
+  for (SkipNode *node = unmarked(m_head->m_next[0].load()); node != m_tail;
+       node = unmarked(node->m_next[0].load())) {
+    cout << "(" << node->m_id << ":" << node->m_levels - 1 << ")";
+  }
+}
+
+bool LockFreeSkipList::verify() const {
+  for (int level = 0; level < SKIP_LEVELS; level++) {
+    SkipNode *below = m_head; // walks the level below alongside
+    SkipNode *pred = m_head;
+    uintptr_t link = m_head->m_next[level].load();
+    while (unmarked(link) != m_tail) {
+      SkipNode *node = unmarked(link);
+      if (isMarked(link) || node == nullptr || node->m_levels <= level ||
+          node->m_id <= pred->m_id || node->m_id < MINID ||
+          node->m_id > MAXID) {
+        return false;
+      }
+      if (level > 0) {
+        while (below != m_tail && below != node) {
+          below = unmarked(below->m_next[level - 1].load());
+        }
+        if (below != node) {
+          return false; // not linked on the level below
+        }
+      }
+      pred = node;
+      link = node->m_next[level].load();
+    }
+    if (isMarked(link)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef WPSKIP_H
+#define WPSKIP_H
+#include "wpower.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Lock-free skip list behind the SKIPLIST TREETYPE. insert, remove and
+// contains may run on any number of threads at once. Every link is an
+// atomic word whose low bit marks the node it leaves as removed at that
+// level, so a remove first marks the node top-down and then any thread that
+// passes it unlinks it with a compare-and-swap.
+//
+// Removed nodes are freed with epoch-based reclamation: every operation runs
+// inside an epoch, and a node unlinked during epoch e is freed once the
+// global epoch reaches e + 2, when no operation that could still hold it is
+// running. The other members must not run concurrently with anything else.
+
+#define SKIP_LEVELS 20 // enough for p = 1/2 over MINID..MAXID
+#define ID_LOCKS 64    // stripes of idLock()
+
+struct SkipNode {
+  int m_id;
+  double m_latitude;
+  double m_longitude;
+  int m_levels;
+  std::atomic<uintptr_t> *m_next; // m_levels links, low bit marks removal
+  // the inserting thread and the list each hold one, whoever drops the last
+  // one has seen the node unlinked at every level and retires it
+  std::atomic<int> m_owners;
+};
+
+class LockFreeSkipList {
+public:
+  friend class Tester;
+
+  LockFreeSkipList();
+  ~LockFreeSkipList();
+
+  // returns false if id is already present, the old location is kept
+  bool insert(int id, double lat, double longitude);
+  bool remove(int id); // returns false if id is not present
+  bool contains(int id) const;
+  // customers with an id in [low, high], safe to call concurrently but not a
+  // snapshot when other threads change the range meanwhile
+  int countRange(int low, int high) const;
+  // a lock striped by id, WirelessPower holds it while logging so calls on
+  // one id reach the log in the order they reach the list
+  std::mutex &idLock(int id) { return m_idLocks[(unsigned)id % ID_LOCKS]; }
+
+  void clear();
+  // appends nodes sorted by id to an empty list, without any atomics
+  void build(const vector<Customer *> &nodes);
+  // appends a copy of every customer to nodes in increasing id order
+  void collect(vector<Customer *> &nodes) const;
+  int size() const;
+  void dump() const; // (id:top level) for every customer in id order
+  // every level sorted and contained in the one below, nothing marked
+  bool verify() const;
+
+private:
+  SkipNode *m_head; // id below MINID, linked at every level
+  SkipNode *m_tail; // id above MAXID, never marked
+  std::mutex m_idLocks[ID_LOCKS];
+
+  // fills preds and succs with the nodes around id on every level and
+  // unlinks any marked node on the way, returns true if succs[0] holds id
+  bool find(int id, SkipNode **preds, SkipNode **succs);
+  void release(SkipNode *node);
+  static int randomLevels();
+  static SkipNode *newNode(int id, double lat, double longitude, int levels);
+};
+
+#endif
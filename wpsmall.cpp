@@ -0,0 +1,91 @@
+#include "wpsmall.h"
+#include <algorithm>
+#include <climits>
+
+SmallRegistry::SmallRegistry() { clear(); }
+
+int SmallRegistry::lowerBound(long long id) const {
+  // the padding makes every probe valid, so the loop never depends on m_size
+  int index = 0;
+  for (int step = SMALL_CUSTOMERS / 2; step > 0; step /= 2) {
+    index += (m_ids[index + step - 1] < id) ? step : 0;
+  }
+  index += (m_ids[index] < id) ? 1 : 0;
+  // an id above INT_MAX is also above the padding
+  return min(index, m_size);
+}
+
+int SmallRegistry::find(int id) const {
+  int index = lowerBound(id);
+  return (index < m_size && m_ids[index] == id) ? index : -1;
+}
+
+bool SmallRegistry::insert(int id, double lat, double longitude) {
+  int index = lowerBound(id);
+  if (index < m_size && m_ids[index] == id) {
+    return true;
+  }
+  if (m_size == SMALL_CUSTOMERS) {
+    return false;
+  }
+  for (int i = m_size; i > index; i--) {
+    m_ids[i] = m_ids[i - 1];
+    m_latitudes[i] = m_latitudes[i - 1];
+    m_longitudes[i] = m_longitudes[i - 1];
+  }
+  m_ids[index] = id;
+  m_latitudes[index] = lat;
+  m_longitudes[index] = longitude;
+  m_size++;
+  return true;
+}
+
+bool SmallRegistry::remove(int id) {
+  int index = find(id);
+  if (index < 0) {
+    return false;
+  }
+  for (int i = index; i < m_size - 1; i++) {
+    m_ids[i] = m_ids[i + 1];
+    m_latitudes[i] = m_latitudes[i + 1];
+    m_longitudes[i] = m_longitudes[i + 1];
+  }
+  m_size--;
+  m_ids[m_size] = INT_MAX;
+  return true;
+}
+
+void SmallRegistry::setLocation(int index, double lat, double longitude) {
+  m_latitudes[index] = lat;
+  m_longitudes[index] = longitude;
+}
+
+void SmallRegistry::clear() {
+  m_size = 0;
+  for (int i = 0; i < SMALL_CUSTOMERS; i++) {
+    m_ids[i] = INT_MAX;
+  }
+}
+
+void SmallRegistry::collect(vector<Customer *> &nodes) const {
+  for (int i = 0; i < m_size; i++) {
+    nodes.push_back(new Customer(m_ids[i], m_latitudes[i], m_longitudes[i]));
+  }
+}
+
+bool SmallRegistry::verify() const {
+  if (m_size < 0 || m_size > SMALL_CUSTOMERS) {
+    return false;
+  }
+  for (int i = 0; i < SMALL_CUSTOMERS; i++) {
+    if (i >= m_size) {
+      if (m_ids[i] != INT_MAX) {
+        return false;
+      }
+    } else if (m_ids[i] < MINID || m_ids[i] > MAXID ||
+               (i > 0 && m_ids[i - 1] >= m_ids[i])) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef WPSMALL_H
+#define WPSMALL_H
+#include "wpower.h"
+
+// Customers of a tiny registry in one sorted array instead of one heap node
+// each. Ids, latitudes and longitudes are kept in separate columns so a
+// search only reads the id column, two cache lines. The unused tail of the
+// id column holds INT_MAX, so lowerBound() is the same log2(SMALL_CUSTOMERS)
+// halving steps plus one final compare for every size, all conditional
+// moves, and never branches on the data.
+
+#define SMALL_CUSTOMERS 32 // a power of two, see lowerBound()
+
+class SmallRegistry {
+public:
+  SmallRegistry();
+
+  int size() const { return m_size; }
+  int getID(int index) const { return m_ids[index]; }
+  double getLatitude(int index) const { return m_latitudes[index]; }
+  double getLongitude(int index) const { return m_longitudes[index]; }
+  // number of ids below id
+  int lowerBound(long long id) const;
+  int find(int id) const; // index of id, -1 if it is not present
+
+  // returns false only when the array is full and id is not present, a
+  // present id keeps its location like WirelessPower::insert
+  bool insert(int id, double lat, double longitude);
+  bool remove(int id); // returns false if id is not present
+  void setLocation(int index, double lat, double longitude);
+  void clear();
+  // appends a copy of every customer to nodes in increasing id order
+  void collect(vector<Customer *> &nodes) const;
+  bool verify() const; // sorted, MINID..MAXID, padded
+
+private:
+  int m_size;
+  int m_ids[SMALL_CUSTOMERS]; // sorted, INT_MAX from m_size on
+  double m_latitudes[SMALL_CUSTOMERS];
+  double m_longitudes[SMALL_CUSTOMERS];
+};
+
+#endif
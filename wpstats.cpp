@@ -0,0 +1,165 @@
+#include "wpstats.h"
+#include <sstream>
+
+static const char *OPNAMES[OPTYPE_COUNT] = {"insert", "remove", "setType",
+                                            "lookup", "insertHinted"};
+static const char *TYPENAMES[TREETYPE_COUNT] = {"BST", "AVL", "SPLAY",
+                                                "REDBLACK", "SKIPLIST"};
+
+LatencyStats::LatencyStats(long long slowNanos, int maxSamples)
+    : m_slowNanos(slowNanos), m_maxSamples(maxSamples),
+      m_created(std::chrono::steady_clock::now()) {
+  clear();
+}
+
+void LatencyStats::clear() {
+  m_counts.assign(OPTYPE_COUNT * TREETYPE_COUNT * LATENCY_BUCKETS, 0);
+  for (int op = 0; op < OPTYPE_COUNT; op++) {
+    for (int type = 0; type < TREETYPE_COUNT; type++) {
+      m_max[op][type] = 0;
+    }
+  }
+  m_samples.clear();
+  m_nextSample = 0;
+}
+
+int LatencyStats::bucketOf(long long nanos) {
+  if (nanos < 16) {
+    return (nanos < 0) ? 0 : (int)nanos;
+  }
+  int exponent = 63 - __builtin_clzll((unsigned long long)nanos);
+  if (exponent > 40) {
+    return LATENCY_BUCKETS - 1;
+  }
+  int mantissa = (int)(nanos >> (exponent - 4)); // 16..31
+  return (exponent - 4) * 16 + mantissa;
+}
+
+long long LatencyStats::bucketTop(int bucket) {
+  if (bucket < 16) {
+    return bucket;
+  }
+  int exponent = bucket / 16 + 3;
+  long long mantissa = bucket % 16 + 16;
+  return ((mantissa + 1) << (exponent - 4)) - 1;
+}
+
+const long long *LatencyStats::histogram(OPTYPE op, TREETYPE type) const {
+  return &m_counts[(op * TREETYPE_COUNT + type) * LATENCY_BUCKETS];
+}
+
+void LatencyStats::record(OPTYPE op, TREETYPE type, int id,
+                          std::chrono::steady_clock::time_point start,
+                          long long nanos, int path, int rotations) {
+  m_counts[(op * TREETYPE_COUNT + type) * LATENCY_BUCKETS + bucketOf(nanos)]++;
+  if (nanos > m_max[op][type]) {
+    m_max[op][type] = nanos;
+  }
+  if (nanos < m_slowNanos || m_maxSamples <= 0) {
+    return;
+  }
+  long long startNanos =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_created)
+          .count();
+  SlowOp sample = {op, type, id, startNanos, nanos, path, rotations};
+  if ((int)m_samples.size() < m_maxSamples) {
+    m_samples.push_back(sample);
+  } else {
+    m_samples[m_nextSample] = sample;
+    m_nextSample = (m_nextSample + 1) % m_maxSamples;
+  }
+}
+
+long long LatencyStats::count(OPTYPE op, TREETYPE type) const {
+  const long long *counts = histogram(op, type);
+  long long total = 0;
+  for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    total += counts[bucket];
+  }
+  return total;
+}
+
+long long LatencyStats::percentile(OPTYPE op, TREETYPE type,
+                                   double percent) const {
+  long long total = count(op, type);
+  if (total == 0) {
+    return 0;
+  }
+  const long long *counts = histogram(op, type);
+  long long rank = (long long)(percent / 100.0 * (total - 1)) + 1;
+  long long seen = 0;
+  for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += counts[bucket];
+    if (seen >= rank) {
+      long long top = bucketTop(bucket);
+      return (top < m_max[op][type]) ? top : m_max[op][type];
+    }
+  }
+  return m_max[op][type];
+}
+
+long long LatencyStats::max(OPTYPE op, TREETYPE type) const {
+  return m_max[op][type];
+}
+
+vector<SlowOp> LatencyStats::slowOps() const {
+  vector<SlowOp> samples(m_samples.begin() + m_nextSample, m_samples.end());
+  samples.insert(samples.end(), m_samples.begin(),
+                 m_samples.begin() + m_nextSample);
+  return samples;
+}
+
+string LatencyStats::toJSON() const {
+  stringstream json;
+  json << "{\"operations\":[";
+  bool first = true;
+  for (int op = 0; op < OPTYPE_COUNT; op++) {
+    for (int type = 0; type < TREETYPE_COUNT; type++) {
+      long long total = count((OPTYPE)op, (TREETYPE)type);
+      if (total == 0) {
+        continue;
+      }
+      json << (first ? "" : ",") << "{\"op\":\"" << OPNAMES[op]
+           << "\",\"type\":\"" << TYPENAMES[type] << "\",\"count\":" << total;
+      double percents[] = {50, 90, 99, 99.9};
+      const char *names[] = {"p50", "p90", "p99", "p999"};
+      for (int i = 0; i < 4; i++) {
+        json << ",\"" << names[i] << "\":"
+             << percentile((OPTYPE)op, (TREETYPE)type, percents[i]);
+      }
+      json << ",\"max\":" << m_max[op][type] << "}";
+      first = false;
+    }
+  }
+  json << "],\"slow\":[";
+  first = true;
+  for (const SlowOp &sample : slowOps()) {
+    json << (first ? "" : ",") << "{\"op\":\"" << OPNAMES[sample.m_op]
+         << "\",\"type\":\"" << TYPENAMES[sample.m_type]
+         << "\",\"id\":" << sample.m_id << ",\"start\":" << sample.m_startNanos
+         << ",\"ns\":" << sample.m_nanos << ",\"path\":" << sample.m_path
+         << ",\"rotations\":" << sample.m_rotations << "}";
+    first = false;
+  }
+  json << "]}";
+  return json.str();
+}
+
+string LatencyStats::toChromeTrace() const {
+  // times are in microseconds, fractions keep the nanoseconds
+  stringstream json;
+  json << "{\"traceEvents\":[";
+  bool first = true;
+  for (const SlowOp &sample : slowOps()) {
+    json << (first ? "" : ",") << "{\"name\":\"" << OPNAMES[sample.m_op]
+         << "\",\"cat\":\"" << TYPENAMES[sample.m_type]
+         << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+         << sample.m_startNanos / 1000.0 << ",\"dur\":"
+         << sample.m_nanos / 1000.0 << ",\"args\":{\"id\":" << sample.m_id
+         << ",\"path\":" << sample.m_path
+         << ",\"rotations\":" << sample.m_rotations << "}}";
+    first = false;
+  }
+  json << "],\"displayTimeUnit\":\"ns\"}";
+  return json.str();
+}
@@ -0,0 +1,66 @@
+#ifndef WPSTATS_H
+#define WPSTATS_H
+#include "wpower.h"
+#include <chrono>
+#include <string>
+
+// Latency histograms of the public WirelessPower operations, one per
+// operation and tree type. Buckets are HDR style: exact below 32ns, then
+// 16 linear buckets per power of two, so every percentile is within 1/16
+// of the true value. Operations slower than slowNanos are also kept as
+// samples with the number of nodes they visited and rotated, up to
+// maxSamples of them, the oldest are overwritten first.
+
+// insertHinted has its own bucket, except where it falls back to insert
+enum OPTYPE { OP_INSERT, OP_REMOVE, OP_SETTYPE, OP_LOOKUP, OP_INSERT_HINTED };
+
+#define OPTYPE_COUNT 5
+#define TREETYPE_COUNT 5
+#define LATENCY_BUCKETS 608 // values up to 2^40 ns, larger ones are clamped
+
+struct SlowOp {
+  OPTYPE m_op;
+  TREETYPE m_type;
+  int m_id;
+  long long m_startNanos; // since the stats were created
+  long long m_nanos;
+  int m_path;      // nodes visited, only splay steps for lookups
+  int m_rotations; // rotations done, including splay steps
+};
+
+class LatencyStats {
+public:
+  LatencyStats(long long slowNanos, int maxSamples = 1024);
+
+  void record(OPTYPE op, TREETYPE type, int id,
+              std::chrono::steady_clock::time_point start, long long nanos,
+              int path, int rotations);
+  void clear();
+
+  long long count(OPTYPE op, TREETYPE type) const;
+  // the largest latency in the bucket holding the percentile, 0 if empty
+  long long percentile(OPTYPE op, TREETYPE type, double percent) const;
+  long long max(OPTYPE op, TREETYPE type) const;
+  // slow operations, oldest first
+  vector<SlowOp> slowOps() const;
+
+  // percentiles per operation and tree type plus every slow sample
+  string toJSON() const;
+  // slow samples as complete events for chrome://tracing or Perfetto
+  string toChromeTrace() const;
+
+private:
+  long long m_slowNanos;
+  int m_maxSamples;
+  std::chrono::steady_clock::time_point m_created;
+  vector<long long> m_counts; // [op][type][bucket]
+  long long m_max[OPTYPE_COUNT][TREETYPE_COUNT];
+  vector<SlowOp> m_samples; // ring buffer once full
+  int m_nextSample;
+
+  static int bucketOf(long long nanos);
+  static long long bucketTop(int bucket);
+  const long long *histogram(OPTYPE op, TREETYPE type) const;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "wptiles.h"
+#include <algorithm>
+
+TileCounts::TileCounts(int levels)
+    : m_levels(min(max(levels, 0), MAX_TILE_LEVELS)), m_counts(m_levels) {
+  for (int level = 0; level < m_levels; level++) {
+    m_counts[level].assign((size_t)1 << (2 * level), 0);
+  }
+}
+
+int TileCounts::levels() const { return m_levels; }
+
+void TileCounts::add(double lat, double longitude, int delta) {
+  for (int level = 0; level < m_levels; level++) {
+    int row = 0;
+    int col = 0;
+    tileOf(level, lat, longitude, row, col);
+    m_counts[level][((size_t)row << level) + col] += delta;
+  }
+}
+
+void TileCounts::clear() {
+  for (vector<int> &counts : m_counts) {
+    counts.assign(counts.size(), 0);
+  }
+}
+
+void TileCounts::tileOf(int level, double lat, double longitude, int &row,
+                        int &col) const {
+  int tiles = 1 << level;
+  row = (int)((lat - MINLAT) / (MAXLAT - MINLAT) * tiles);
+  col = (int)((longitude - MINLONG) / (MAXLONG - MINLONG) * tiles);
+  row = max(0, min(row, tiles - 1)); // MAXLAT and MAXLONG go in the last tile
+  col = max(0, min(col, tiles - 1));
+}
+
+int TileCounts::count(int level, int row, int col) const {
+  if (level < 0 || level >= m_levels || row < 0 || col < 0 ||
+      row >= (1 << level) || col >= (1 << level)) {
+    return 0;
+  }
+  return m_counts[level][((size_t)row << level) + col];
+}
+
+double TileCounts::density(int level, int row, int col) const {
+  double tiles = 1 << level;
+  double area =
+      ((MAXLAT - MINLAT) / tiles) * ((MAXLONG - MINLONG) / tiles);
+  return count(level, row, col) / area;
+}
+
+int TileCounts::countInBox(int level, double minLat, double minLong,
+                           double maxLat, double maxLong) const {
+  if (level < 0 || level >= m_levels || minLat > maxLat ||
+      minLong > maxLong) {
+    return 0;
+  }
+  int minRow = 0;
+  int minCol = 0;
+  int maxRow = 0;
+  int maxCol = 0;
+  tileOf(level, minLat, minLong, minRow, minCol);
+  tileOf(level, maxLat, maxLong, maxRow, maxCol);
+  return countInBox(level, 0, 0, 0, minRow, minCol, maxRow, maxCol);
+}
+
+int TileCounts::countInBox(int level, int tileLevel, int row, int col,
+                           int minRow, int minCol, int maxRow,
+                           int maxCol) const {
+  // the span of target level rows and cols this tile covers
+  int shift = level - tileLevel;
+  int firstRow = row << shift;
+  int firstCol = col << shift;
+  int lastRow = firstRow + (1 << shift) - 1;
+  int lastCol = firstCol + (1 << shift) - 1;
+  if (lastRow < minRow || firstRow > maxRow || lastCol < minCol ||
+      firstCol > maxCol) {
+    return 0; // disjoint
+  }
+  if (firstRow >= minRow && lastRow <= maxRow && firstCol >= minCol &&
+      lastCol <= maxCol) {
+    return count(tileLevel, row, col); // whole tile inside the box
+  }
+  int total = 0;
+  for (int child = 0; child < 4; child++) {
+    total += countInBox(level, tileLevel + 1, 2 * row + child / 2,
+                        2 * col + child % 2, minRow, minCol, maxRow, maxCol);
+  }
+  return total;
+}
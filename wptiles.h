@@ -0,0 +1,43 @@
+#ifndef WPTILES_H
+#define WPTILES_H
+#include "wpower.h"
+
+// Customer counts per latitude/longitude tile at several zoom levels. Level
+// l splits MINLAT..MAXLAT by MINLONG..MAXLONG into 2^l x 2^l tiles, so
+// every level is a quadtree refinement of the one above it. Adding or
+// removing a customer touches one tile per level. The level count is
+// clamped to 0..MAX_TILE_LEVELS to bound memory: the deepest level allowed
+// holds 4^11 tiles (16 MB of counts) and all 12 levels about 21 MB, each
+// level more would quadruple that.
+
+const int MAX_TILE_LEVELS = 12;
+
+class TileCounts {
+public:
+  TileCounts(int levels);
+
+  int levels() const;
+  void add(double lat, double longitude, int delta);
+  void clear();
+  // tile holding a location at a level, row grows with latitude and col
+  // with longitude
+  void tileOf(int level, double lat, double longitude, int &row,
+              int &col) const;
+  int count(int level, int row, int col) const;
+  // customers per square degree in one tile
+  double density(int level, int row, int col) const;
+  // customers in every tile of level that touches the box, found by a
+  // quadtree descent that takes whole tiles inside the box from coarser
+  // levels
+  int countInBox(int level, double minLat, double minLong, double maxLat,
+                 double maxLong) const;
+
+private:
+  int m_levels;
+  vector<vector<int>> m_counts; // m_counts[level][row * 2^level + col]
+
+  int countInBox(int level, int tileLevel, int row, int col, int minRow,
+                 int minCol, int maxRow, int maxCol) const;
+};
+
+#endif
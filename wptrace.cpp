@@ -0,0 +1,116 @@
+#include "wptrace.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define TRACE_RECORD_SIZE 29
+#define MAX_BUFFER_BYTES (1 << 16) // write out once this much is buffered
+
+static void putBytes(string &record, const void *value, size_t size) {
+  record.append((const char *)value, size);
+}
+
+TraceRecorder::TraceRecorder(const string &path)
+    : m_file(fopen(path.c_str(), "wb")),
+      m_start(std::chrono::steady_clock::now()) {}
+
+TraceRecorder::~TraceRecorder() {
+  flush();
+  if (m_file != nullptr) {
+    fclose(m_file);
+  }
+}
+
+bool TraceRecorder::isOpen() const { return m_file != nullptr; }
+
+void TraceRecorder::record(TRACEOP op, int id, double lat, double longitude) {
+  long long micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - m_start)
+                         .count();
+  encode(m_buffer, TraceRecord{op, id, lat, longitude, micros});
+  if (m_buffer.size() >= MAX_BUFFER_BYTES) {
+    flush();
+  }
+}
+
+void TraceRecorder::flush() {
+  if (m_file != nullptr && !m_buffer.empty()) {
+    fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    fflush(m_file);
+  }
+  m_buffer.clear();
+}
+
+void TraceRecorder::encode(string &records, const TraceRecord &record) {
+  char op = record.m_op;
+  int32_t id = record.m_id;
+  int64_t micros = record.m_micros;
+  putBytes(records, &op, sizeof(op));
+  putBytes(records, &id, sizeof(id));
+  putBytes(records, &record.m_latitude, sizeof(record.m_latitude));
+  putBytes(records, &record.m_longitude, sizeof(record.m_longitude));
+  putBytes(records, &micros, sizeof(micros));
+}
+
+bool TraceRecorder::read(const string &path, vector<TraceRecord> &records) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  char data[TRACE_RECORD_SIZE];
+  while (fread(data, 1, TRACE_RECORD_SIZE, file) == TRACE_RECORD_SIZE) {
+    TraceRecord record;
+    int32_t id = 0;
+    int64_t micros = 0;
+    record.m_op = (TRACEOP)data[0];
+    memcpy(&id, data + 1, sizeof(id));
+    memcpy(&record.m_latitude, data + 5, sizeof(double));
+    memcpy(&record.m_longitude, data + 13, sizeof(double));
+    memcpy(&micros, data + 21, sizeof(micros));
+    record.m_id = id;
+    record.m_micros = micros;
+    records.push_back(record);
+  }
+  fclose(file);
+  return true;
+}
+
+bool TraceRecorder::write(const string &path,
+                          const vector<TraceRecord> &records) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  string data;
+  for (const TraceRecord &record : records) {
+    encode(data, record);
+  }
+  bool pass = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && pass;
+}
+
+void TraceRecorder::apply(const TraceRecord &record, WirelessPower &wp,
+                          bool applyTypes) {
+  switch (record.m_op) {
+  case TRACE_INSERT:
+    wp.insert(Customer(record.m_id, record.m_latitude, record.m_longitude));
+    break;
+  case TRACE_REMOVE:
+    wp.remove(record.m_id);
+    break;
+  case TRACE_SETTYPE:
+    if (applyTypes) {
+      wp.setType((TREETYPE)record.m_id, (int)record.m_latitude);
+    }
+    break;
+  case TRACE_LOOKUP:
+    wp.touch(record.m_id);
+    break;
+  case TRACE_SETCAPACITY:
+    wp.setCapacity(record.m_id);
+    break;
+  case TRACE_SETPOLICY:
+    wp.setSplayPolicy((SPLAYPOLICY)record.m_id, record.m_latitude);
+    break;
+  }
+}
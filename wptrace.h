@@ -0,0 +1,65 @@
+#ifndef WPTRACE_H
+#define WPTRACE_H
+#include "wpower.h"
+#include <chrono>
+#include <string>
+
+// Binary trace of the calls made on an attached WirelessPower, for
+// replaying a production mix offline with wpreplay. Every insert, remove,
+// setType, setCapacity, setSplayPolicy and touch becomes one fixed-size
+// record stamped with the microseconds since the recorder was created.
+// Customers removed in bulk by removeRange or removeBatch are recorded as
+// single removes. Evictions are not recorded, the replayed registry evicts
+// the same customers itself once it gets the same capacity and policy,
+// exactly so when recording started on an empty registry.
+//
+// Record layout, fields in host byte order:
+//   op(1) id(4) latitude(8) longitude(8) micros(8)
+// A SETTYPE record keeps the TREETYPE in id and the budget in latitude, a
+// SETCAPACITY record the capacity in id and a SETPOLICY record the
+// SPLAYPOLICY in id and its parameter in latitude.
+
+enum TRACEOP {
+  TRACE_INSERT = 1,
+  TRACE_REMOVE = 2,
+  TRACE_SETTYPE = 3,
+  TRACE_LOOKUP = 4,
+  TRACE_SETCAPACITY = 5,
+  TRACE_SETPOLICY = 6
+};
+
+struct TraceRecord {
+  TRACEOP m_op;
+  int m_id;
+  double m_latitude;
+  double m_longitude;
+  long long m_micros; // since the start of the trace
+};
+
+class TraceRecorder {
+public:
+  TraceRecorder(const string &path);
+  ~TraceRecorder(); // writes anything still buffered
+  bool isOpen() const;
+
+  void record(TRACEOP op, int id, double lat = 0, double longitude = 0);
+  void flush();
+
+  // reads every complete record, returns false if the file cannot be read
+  static bool read(const string &path, vector<TraceRecord> &records);
+  // writes records as a trace, used for synthetic traces
+  static bool write(const string &path, const vector<TraceRecord> &records);
+  // makes the call a record stands for, SETTYPE records are skipped unless
+  // applyTypes is true
+  static void apply(const TraceRecord &record, WirelessPower &wp,
+                    bool applyTypes = true);
+
+private:
+  FILE *m_file;
+  string m_buffer; // records not yet written to m_file
+  std::chrono::steady_clock::time_point m_start;
+
+  static void encode(string &records, const TraceRecord &record);
+};
+
+#endif